@@ -0,0 +1,122 @@
+#pragma once
+
+#include <math.h>
+
+#include <SFML/System.hpp>
+
+#include "Simd.hpp"
+
+namespace Manta {
+
+	// Row major 3x4 matrix, point' = M * (point, 1)
+	struct Affine {
+		float m[12];
+
+		static Affine identity() {
+			return Affine{ {
+				1, 0, 0, 0,
+				0, 1, 0, 0,
+				0, 0, 1, 0
+			} };
+		}
+
+		sf::Vector3f apply(sf::Vector3f p) const {
+			return sf::Vector3f(
+				m[0] * p.x + m[1] * p.y + m[2] * p.z + m[3],
+				m[4] * p.x + m[5] * p.y + m[6] * p.z + m[7],
+				m[8] * p.x + m[9] * p.y + m[10] * p.z + m[11]
+			);
+		}
+
+		// apply() of simd::WIDTH points at once, summed in the same order so
+		// every lane matches the scalar result
+		void apply(simd::vfloat x, simd::vfloat y, simd::vfloat z, simd::vfloat* outX, simd::vfloat* outY, simd::vfloat* outZ) const {
+			*outX = simd::add(simd::add(simd::add(simd::mul(simd::set(m[0]), x), simd::mul(simd::set(m[1]), y)), simd::mul(simd::set(m[2]), z)), simd::set(m[3]));
+			*outY = simd::add(simd::add(simd::add(simd::mul(simd::set(m[4]), x), simd::mul(simd::set(m[5]), y)), simd::mul(simd::set(m[6]), z)), simd::set(m[7]));
+			*outZ = simd::add(simd::add(simd::add(simd::mul(simd::set(m[8]), x), simd::mul(simd::set(m[9]), y)), simd::mul(simd::set(m[10]), z)), simd::set(m[11]));
+		}
+
+		// Only the linear part, for directions and normals
+		sf::Vector3f applyLinear(sf::Vector3f p) const {
+			return sf::Vector3f(
+				m[0] * p.x + m[1] * p.y + m[2] * p.z,
+				m[4] * p.x + m[5] * p.y + m[6] * p.z,
+				m[8] * p.x + m[9] * p.y + m[10] * p.z
+			);
+		}
+
+		// Transposed linear part, maps local gradients back to world space
+		sf::Vector3f applyTransposed(sf::Vector3f p) const {
+			return sf::Vector3f(
+				m[0] * p.x + m[4] * p.y + m[8] * p.z,
+				m[1] * p.x + m[5] * p.y + m[9] * p.z,
+				m[2] * p.x + m[6] * p.y + m[10] * p.z
+			);
+		}
+
+		// Applies this first, then next
+		Affine then(const Affine& next) const {
+			Affine r;
+			for (int row = 0; row < 3; row++) {
+				const float* n = &next.m[row * 4];
+				for (int col = 0; col < 4; col++) {
+					r.m[row * 4 + col] =
+						n[0] * m[col] +
+						n[1] * m[4 + col] +
+						n[2] * m[8 + col] +
+						(col == 3 ? n[3] : 0);
+				}
+			}
+			return r;
+		}
+
+		// Largest singular value of the linear part, i.e. how much the map
+		// can stretch a distance. Square root of the largest eigenvalue of
+		// the symmetric M^T M, solved in closed form.
+		float maxStretch() const {
+			double a[3][3];
+			for (int i = 0; i < 3; i++) {
+				for (int j = 0; j < 3; j++) {
+					a[i][j] =
+						(double)m[i] * m[j] +
+						(double)m[4 + i] * m[4 + j] +
+						(double)m[8 + i] * m[8 + j];
+				}
+			}
+
+			double p1 = a[0][1] * a[0][1] + a[0][2] * a[0][2] + a[1][2] * a[1][2];
+			double q = (a[0][0] + a[1][1] + a[2][2]) / 3;
+
+			double largest;
+			if (p1 <= 1e-12 * q * q) {
+				largest = fmax(a[0][0], fmax(a[1][1], a[2][2]));
+			}
+			else {
+				double p2 =
+					(a[0][0] - q) * (a[0][0] - q) +
+					(a[1][1] - q) * (a[1][1] - q) +
+					(a[2][2] - q) * (a[2][2] - q) + 2 * p1;
+				double p = sqrt(p2 / 6);
+
+				double b[3][3];
+				for (int i = 0; i < 3; i++) {
+					for (int j = 0; j < 3; j++) {
+						b[i][j] = (a[i][j] - (i == j ? q : 0)) / p;
+					}
+				}
+
+				double r = (
+					b[0][0] * (b[1][1] * b[2][2] - b[1][2] * b[2][1]) -
+					b[0][1] * (b[1][0] * b[2][2] - b[1][2] * b[2][0]) +
+					b[0][2] * (b[1][0] * b[2][1] - b[1][1] * b[2][0])
+				) / 2;
+
+				double phi = acos(fmin(fmax(r, -1.0), 1.0)) / 3;
+				largest = q + 2 * p * cos(phi);
+			}
+
+			// Round up a little, an underestimate would overshoot surfaces
+			return (float)(sqrt(largest) * (1 + 1e-5));
+		}
+	};
+}
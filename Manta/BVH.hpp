@@ -0,0 +1,226 @@
+#pragma once
+
+#include <algorithm>
+#include <bitset>
+#include <vector>
+
+#include <SFML/System.hpp>
+
+#include "Bounds.hpp"
+#include "Simd.hpp"
+
+namespace Manta {
+
+	// Bounding volume hierarchy over a list of conservative bounds. Leaves
+	// reference the position of a bound in the list it was built from, so
+	// callers keep their own storage and evaluate candidates themselves.
+	class BVH {
+	public:
+		static const unsigned int LEAF_SIZE = 4;
+
+		void build(const std::vector<Bounds>& bounds, const std::vector<unsigned int>& items) {
+			this->nodes.clear();
+			this->indices = items;
+
+			if (items.empty()) return;
+
+			std::vector<sf::Vector3f> centroids(bounds.size());
+			for (unsigned int i : items) centroids[i] = bounds[i].center();
+
+			this->nodes.reserve(2 * (items.size() / LEAF_SIZE + 1));
+			this->buildNode(bounds, centroids, 0, (unsigned int)items.size());
+		}
+
+		bool isEmpty() const {
+			return this->nodes.empty();
+		}
+
+		// Returns the smallest value of evaluate(item, best) over all items
+		// whose bound is closer than the best distance found so far. best
+		// seeds the search, outIndex only changes if something closer was
+		// found and has to be valid (or UINT_MAX) on entry.
+		// evaluate() must never return less than the distance to the bound.
+		// It gets the best distance so far and may answer anything at least
+		// as large once it knows the item can't get closer.
+		template<typename Evaluate>
+		float nearest(sf::Vector3f point, float best, unsigned int* outIndex, Evaluate evaluate) const {
+			if (this->nodes.empty()) return best;
+
+			struct Entry { unsigned int node; float distance; };
+			Entry stack[64];
+			unsigned int stackSize = 0;
+
+			stack[stackSize++] = Entry{ 0, this->nodes[0].bounds.distanceTo(point) };
+
+			while (stackSize > 0) {
+				Entry entry = stack[--stackSize];
+
+				// Inside a surface best turns negative, then every node that
+				// contains the point still has to be visited
+				if (entry.distance > 0 && entry.distance > best) continue;
+
+				const Node& node = this->nodes[entry.node];
+
+				if (node.count > 0) {
+					for (unsigned int i = node.first; i < node.first + node.count; i++) {
+						// Ties go to the lower index, like a linear scan
+						float current = evaluate(this->indices[i], best);
+						if (current < best || (current == best && this->indices[i] < *outIndex)) {
+							best = current;
+							*outIndex = this->indices[i];
+						}
+					}
+					continue;
+				}
+
+				unsigned int left = entry.node + 1;
+				unsigned int right = node.right;
+
+				float leftDistance = this->nodes[left].bounds.distanceTo(point);
+				float rightDistance = this->nodes[right].bounds.distanceTo(point);
+
+				// Push the far child first so the near one is visited first
+				// and tightens best before the other is tested
+				if (leftDistance < rightDistance) {
+					stack[stackSize++] = Entry{ right, rightDistance };
+					stack[stackSize++] = Entry{ left, leftDistance };
+				}
+				else {
+					stack[stackSize++] = Entry{ left, leftDistance };
+					stack[stackSize++] = Entry{ right, rightDistance };
+				}
+			}
+
+			return best;
+		}
+
+		// nearest() of the simd::WIDTH points x, y, z at once, for the lanes
+		// set in active. best holds the best distance of every lane, which
+		// evaluate(item, lanes) has to lower itself for the lanes it gets,
+		// those whose best the item's node may still beat. Nodes are
+		// visited as long as any lane needs them, nearer first for most.
+		template<typename Evaluate>
+		void nearest(simd::vfloat x, simd::vfloat y, simd::vfloat z, unsigned int active, const float* best, Evaluate evaluate) const {
+			if (this->nodes.empty()) return;
+
+			struct Entry { unsigned int node; unsigned int lanes; simd::vfloat distance; };
+			Entry stack[64];
+			unsigned int stackSize = 0;
+
+			const simd::vfloat zero = simd::set(0);
+
+			stack[stackSize++] = Entry{ 0, active, distanceTo(this->nodes[0].bounds, x, y, z) };
+
+			while (stackSize > 0) {
+				Entry entry = stack[--stackSize];
+
+				// Same test as the single point version, per lane
+				simd::vfloat bestDistance = simd::load(best);
+				unsigned int lanes = entry.lanes & (
+					simd::bits(simd::lessEqual(entry.distance, zero)) |
+					simd::bits(simd::lessEqual(entry.distance, bestDistance))
+				);
+				if (lanes == 0) continue;
+
+				const Node& node = this->nodes[entry.node];
+
+				if (node.count > 0) {
+					for (unsigned int i = node.first; i < node.first + node.count; i++) {
+						evaluate(this->indices[i], lanes);
+					}
+					continue;
+				}
+
+				unsigned int left = entry.node + 1;
+				unsigned int right = node.right;
+
+				simd::vfloat leftDistance = distanceTo(this->nodes[left].bounds, x, y, z);
+				simd::vfloat rightDistance = distanceTo(this->nodes[right].bounds, x, y, z);
+
+				// Lanes usually agree on the near child, otherwise the
+				// majority decides
+				unsigned int leftNearer = lanes & simd::bits(simd::lessThan(leftDistance, rightDistance));
+				if (2 * std::bitset<32>(leftNearer).count() > std::bitset<32>(lanes).count()) {
+					stack[stackSize++] = Entry{ right, lanes, rightDistance };
+					stack[stackSize++] = Entry{ left, lanes, leftDistance };
+				}
+				else {
+					stack[stackSize++] = Entry{ left, lanes, leftDistance };
+					stack[stackSize++] = Entry{ right, lanes, rightDistance };
+				}
+			}
+		}
+
+	private:
+		// Leaves have count > 0 and reference indices[first, first + count).
+		// The left child of an inner node directly follows it.
+		struct Node {
+			Bounds bounds;
+			unsigned int first = 0;
+			unsigned int count = 0;
+			unsigned int right = 0;
+		};
+
+		std::vector<Node> nodes;
+		std::vector<unsigned int> indices;
+
+		// Bounds::distanceTo() of simd::WIDTH points
+		static simd::vfloat distanceTo(const Bounds& bounds, simd::vfloat x, simd::vfloat y, simd::vfloat z) {
+			const simd::vfloat zero = simd::set(0);
+
+			simd::vfloat dx = simd::max(simd::max(simd::sub(simd::set(bounds.min.x), x), simd::sub(x, simd::set(bounds.max.x))), zero);
+			simd::vfloat dy = simd::max(simd::max(simd::sub(simd::set(bounds.min.y), y), simd::sub(y, simd::set(bounds.max.y))), zero);
+			simd::vfloat dz = simd::max(simd::max(simd::sub(simd::set(bounds.min.z), z), simd::sub(z, simd::set(bounds.max.z))), zero);
+
+			return simd::sqrt(simd::add(simd::add(simd::mul(dx, dx), simd::mul(dy, dy)), simd::mul(dz, dz)));
+		}
+
+		unsigned int buildNode(
+			const std::vector<Bounds>& bounds,
+			const std::vector<sf::Vector3f>& centroids,
+			unsigned int begin,
+			unsigned int end
+		) {
+			unsigned int nodeIndex = (unsigned int)this->nodes.size();
+			this->nodes.push_back(Node());
+
+			Bounds nodeBounds = Bounds::empty();
+			Bounds centroidBounds = Bounds::empty();
+			for (unsigned int i = begin; i < end; i++) {
+				nodeBounds.extend(bounds[this->indices[i]]);
+				centroidBounds.extend(centroids[this->indices[i]]);
+			}
+			this->nodes[nodeIndex].bounds = nodeBounds;
+
+			if (end - begin <= LEAF_SIZE) {
+				this->nodes[nodeIndex].first = begin;
+				this->nodes[nodeIndex].count = end - begin;
+				return nodeIndex;
+			}
+
+			// Median split along the longest axis of the centroids
+			sf::Vector3f extent = centroidBounds.size();
+			int axis = 0;
+			if (extent.y > extent.x) axis = 1;
+			if (extent.z > (axis == 0 ? extent.x : extent.y)) axis = 2;
+
+			unsigned int middle = begin + (end - begin) / 2;
+			std::nth_element(
+				this->indices.begin() + begin,
+				this->indices.begin() + middle,
+				this->indices.begin() + end,
+				[&centroids, axis](unsigned int a, unsigned int b) {
+					if (axis == 0) return centroids[a].x < centroids[b].x;
+					if (axis == 1) return centroids[a].y < centroids[b].y;
+					return centroids[a].z < centroids[b].z;
+				}
+			);
+
+			this->buildNode(bounds, centroids, begin, middle);
+			unsigned int right = this->buildNode(bounds, centroids, middle, end);
+			this->nodes[nodeIndex].right = right;
+
+			return nodeIndex;
+		}
+	};
+}
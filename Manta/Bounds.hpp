@@ -0,0 +1,117 @@
+#pragma once
+
+#include <limits>
+#include <utility>
+
+#include <SFML/System.hpp>
+
+namespace Manta {
+
+	// Axis aligned box in world space. Used as a conservative bound around
+	// shapes, so the distance to a bound never exceeds the distance to the
+	// surface it encloses.
+	struct Bounds {
+		sf::Vector3f min;
+		sf::Vector3f max;
+
+		static Bounds empty() {
+			const float inf = std::numeric_limits<float>::infinity();
+			return Bounds{ sf::Vector3f(inf, inf, inf), sf::Vector3f(-inf, -inf, -inf) };
+		}
+
+		static Bounds infinite() {
+			const float inf = std::numeric_limits<float>::infinity();
+			return Bounds{ sf::Vector3f(-inf, -inf, -inf), sf::Vector3f(inf, inf, inf) };
+		}
+
+		static Bounds cube(float halfExtent) {
+			return Bounds{
+				sf::Vector3f(-halfExtent, -halfExtent, -halfExtent),
+				sf::Vector3f(halfExtent, halfExtent, halfExtent)
+			};
+		}
+
+		bool isEmpty() const {
+			return this->min.x > this->max.x || this->min.y > this->max.y || this->min.z > this->max.z;
+		}
+
+		bool isInfinite() const {
+			return std::isinf(this->min.x) || std::isinf(this->min.y) || std::isinf(this->min.z) ||
+				std::isinf(this->max.x) || std::isinf(this->max.y) || std::isinf(this->max.z);
+		}
+
+		void extend(sf::Vector3f point) {
+			this->min = sf::Vector3f(fminf(this->min.x, point.x), fminf(this->min.y, point.y), fminf(this->min.z, point.z));
+			this->max = sf::Vector3f(fmaxf(this->max.x, point.x), fmaxf(this->max.y, point.y), fmaxf(this->max.z, point.z));
+		}
+
+		void extend(const Bounds& other) {
+			this->min = sf::Vector3f(fminf(this->min.x, other.min.x), fminf(this->min.y, other.min.y), fminf(this->min.z, other.min.z));
+			this->max = sf::Vector3f(fmaxf(this->max.x, other.max.x), fmaxf(this->max.y, other.max.y), fmaxf(this->max.z, other.max.z));
+		}
+
+		sf::Vector3f center() const {
+			return (this->min + this->max) * .5f;
+		}
+
+		sf::Vector3f size() const {
+			return this->max - this->min;
+		}
+
+		sf::Vector3f corner(unsigned int i) const {
+			return sf::Vector3f(
+				(i & 1) ? this->max.x : this->min.x,
+				(i & 2) ? this->max.y : this->min.y,
+				(i & 4) ? this->max.z : this->min.z
+			);
+		}
+
+		// Same box grown by margin on every side
+		Bounds expanded(float margin) const {
+			sf::Vector3f offset(margin, margin, margin);
+			return Bounds{ this->min - offset, this->max + offset };
+		}
+
+		// Parameter range [start, end] in which origin + t * direction lies
+		// inside the box, false if the line misses it. Components of
+		// direction may be 0.
+		bool intersect(sf::Vector3f origin, sf::Vector3f direction, float* start, float* end) const {
+			if (this->isEmpty()) return false;
+
+			const float o[3] = { origin.x, origin.y, origin.z };
+			const float d[3] = { direction.x, direction.y, direction.z };
+			const float lo[3] = { this->min.x, this->min.y, this->min.z };
+			const float hi[3] = { this->max.x, this->max.y, this->max.z };
+
+			float first = -std::numeric_limits<float>::infinity();
+			float last = std::numeric_limits<float>::infinity();
+
+			for (int i = 0; i < 3; i++) {
+				if (d[i] == 0) {
+					if (o[i] < lo[i] || o[i] > hi[i]) return false;
+					continue;
+				}
+
+				float t0 = (lo[i] - o[i]) / d[i];
+				float t1 = (hi[i] - o[i]) / d[i];
+				if (t0 > t1) std::swap(t0, t1);
+
+				first = fmaxf(first, t0);
+				last = fminf(last, t1);
+			}
+
+			*start = first;
+			*end = last;
+			return first <= last;
+		}
+
+		// Euclidean distance from point to the box, 0 if the point is inside
+		float distanceTo(sf::Vector3f point) const {
+			float dx = fmaxf(fmaxf(this->min.x - point.x, point.x - this->max.x), 0);
+			float dy = fmaxf(fmaxf(this->min.y - point.y, point.y - this->max.y), 0);
+			float dz = fmaxf(fmaxf(this->min.z - point.z, point.z - this->max.z), 0);
+
+			return sqrtf(dx * dx + dy * dy + dz * dz);
+		}
+	};
+}
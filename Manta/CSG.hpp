@@ -0,0 +1,260 @@
+#pragma once
+
+#include <math.h>
+
+#include <atomic>
+#include <limits>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include <SFML/System.hpp>
+
+#include "Bounds.hpp"
+#include "Shape.hpp"
+#include "RenderStats.hpp"
+
+namespace Manta {
+
+	enum class CSGOperation {
+		Leaf,
+		Union,
+		Subtract,	// First child with the second cut out of it
+		Intersect,
+		SmoothUnion	// Union melted together over blend units
+	};
+
+	// Shapes combined by boolean operations into one distance field. Nodes
+	// are added bottom up, each call returns the index its parents refer
+	// to, and the last node added is the root. Every node carries a
+	// conservative bound, so evaluation skips whole subtrees that can't
+	// get closer than the best distance known so far.
+	class CSG : public DistanceField {
+	public:
+
+		// Takes ownership of shape, its transforms place it in the space
+		// of the tree
+		unsigned int leaf(Shape* shape) {
+			shape->bake();
+
+			Node node;
+			node.operation = CSGOperation::Leaf;
+			node.first = (unsigned int)this->leaves.size();
+			node.bounds = shape->getBounds();
+
+			this->leaves.push_back(*shape);
+			delete shape;
+
+			return this->push(node);
+		}
+
+		unsigned int unite(unsigned int a, unsigned int b) {
+			Bounds bounds = this->nodes[a].bounds;
+			bounds.extend(this->nodes[b].bounds);
+
+			return this->push(this->inner(CSGOperation::Union, a, b, bounds));
+		}
+
+		// Balanced union over all of children. Neighbours in the list share
+		// subtrees, so nearby parts should be next to each other.
+		unsigned int unite(const std::vector<unsigned int>& children) {
+			std::vector<unsigned int> level = children;
+
+			while (level.size() > 1) {
+				std::vector<unsigned int> next;
+				for (size_t i = 0; i + 1 < level.size(); i += 2) next.push_back(this->unite(level[i], level[i + 1]));
+				if (level.size() % 2 == 1) next.push_back(level.back());
+
+				level.swap(next);
+			}
+
+			return level[0];
+		}
+
+		unsigned int subtract(unsigned int a, unsigned int b) {
+			return this->push(this->inner(CSGOperation::Subtract, a, b, this->nodes[a].bounds));
+		}
+
+		unsigned int intersect(unsigned int a, unsigned int b) {
+			const Bounds& first = this->nodes[a].bounds;
+			const Bounds& second = this->nodes[b].bounds;
+
+			Bounds bounds{
+				sf::Vector3f(fmaxf(first.min.x, second.min.x), fmaxf(first.min.y, second.min.y), fmaxf(first.min.z, second.min.z)),
+				sf::Vector3f(fminf(first.max.x, second.max.x), fminf(first.max.y, second.max.y), fminf(first.max.z, second.max.z))
+			};
+
+			return this->push(this->inner(CSGOperation::Intersect, a, b, bounds));
+		}
+
+		// Polynomial smooth minimum, surfaces closer than blend melt
+		// together. The blend pushes the surface out by at most blend / 4.
+		unsigned int smoothUnite(unsigned int a, unsigned int b, float blend) {
+			Bounds bounds = this->nodes[a].bounds;
+			bounds.extend(this->nodes[b].bounds);
+
+			Node node = this->inner(CSGOperation::SmoothUnion, a, b, bounds.expanded(blend * .25f));
+			node.blend = blend;
+			return this->push(node);
+		}
+
+		// Bound of the root, in the space of the tree
+		Bounds getBounds() const {
+			return this->nodes.empty() ? Bounds::empty() : this->nodes.back().bounds;
+		}
+
+		unsigned int getNodeCount() const {
+			return (unsigned int)this->nodes.size();
+		}
+
+		unsigned int getLeafCount() const {
+			return (unsigned int)this->leaves.size();
+		}
+
+		// Leaf evaluations are added to the distance estimates of
+		// RenderStats, on top of the one the scene counts for the tree
+		float distance(sf::Vector3f point, float cutoff) const override {
+			if (this->nodes.empty()) return std::numeric_limits<float>::infinity();
+
+			unsigned int root = (unsigned int)this->nodes.size() - 1;
+			unsigned int evaluations = 0;
+
+			float distance = this->evaluate(root, point, this->nodes[root].bounds.distanceTo(point), cutoff, isPruning(), &evaluations);
+
+			if (RenderStats::isEnabled()) RenderStats::local().distanceEstimates += evaluations;
+
+			return distance;
+		}
+
+		// Off evaluates every leaf of every tree, for comparisons
+		static void setPruning(bool pruning) {
+			pruningFlag().store(pruning, std::memory_order_relaxed);
+		}
+
+		static bool isPruning() {
+			return pruningFlag().load(std::memory_order_relaxed);
+		}
+
+	private:
+		// Inner nodes reference their children, leaves the shape in leaves
+		// through first
+		struct Node {
+			CSGOperation operation = CSGOperation::Leaf;
+			unsigned int first = 0;
+			unsigned int second = 0;
+			float blend = 0;
+			Bounds bounds;
+		};
+
+		std::vector<Node> nodes;
+		std::vector<Shape> leaves;
+
+		Node inner(CSGOperation operation, unsigned int a, unsigned int b, const Bounds& bounds) const {
+			Node node;
+			node.operation = operation;
+			node.first = a;
+			node.second = b;
+			node.bounds = bounds;
+			return node;
+		}
+
+		unsigned int push(const Node& node) {
+			this->nodes.push_back(node);
+			return (unsigned int)this->nodes.size() - 1;
+		}
+
+		// boundDistance is the distance from point to the bound of node
+		// index, computed by the caller to decide the order of children.
+		// Pruned subtrees answer with it, a lower bound of their surface.
+		float evaluate(unsigned int index, sf::Vector3f point, float boundDistance, float cutoff, bool prune, unsigned int* evaluations) const {
+			// Inside a surface cutoff turns negative, then nodes that contain
+			// the point still have to be evaluated
+			if (prune && boundDistance > 0 && boundDistance > cutoff) return boundDistance;
+
+			const Node& node = this->nodes[index];
+
+			if (node.operation == CSGOperation::Leaf) {
+				(*evaluations)++;
+				return this->leaves[node.first].distanceEstimate(point, cutoff);
+			}
+
+			unsigned int first = node.first;
+			unsigned int second = node.second;
+			float firstDistance = this->nodes[first].bounds.distanceTo(point);
+			float secondDistance = this->nodes[second].bounds.distanceTo(point);
+
+			switch (node.operation) {
+			case CSGOperation::Union: {
+				// Nearer child first, its distance is the cutoff of the other
+				if (secondDistance < firstDistance) {
+					std::swap(first, second);
+					std::swap(firstDistance, secondDistance);
+				}
+
+				float near = this->evaluate(first, point, firstDistance, cutoff, prune, evaluations);
+				return fminf(near, this->evaluate(second, point, secondDistance, fminf(cutoff, near), prune, evaluations));
+			}
+			case CSGOperation::Subtract: {
+				float kept = this->evaluate(first, point, firstDistance, cutoff, prune, evaluations);
+				if (prune && kept > cutoff) return kept;
+
+				// The cut only matters where it reaches deeper than -kept
+				return fmaxf(kept, -this->evaluate(second, point, secondDistance, -kept, prune, evaluations));
+			}
+			case CSGOperation::Intersect: {
+				// Farther child first, it decides the maximum more often
+				if (secondDistance > firstDistance) {
+					std::swap(first, second);
+					std::swap(firstDistance, secondDistance);
+				}
+
+				float far = this->evaluate(first, point, firstDistance, cutoff, prune, evaluations);
+				if (prune && far > cutoff) return raise(far, boundDistance);
+
+				// Both estimates can stay below the distance to the overlap of
+				// the bounds, which is a lower bound as well
+				float both = fmaxf(far, this->evaluate(second, point, secondDistance, cutoff, prune, evaluations));
+				return raise(both, boundDistance);
+			}
+			case CSGOperation::SmoothUnion: {
+				if (secondDistance < firstDistance) {
+					std::swap(first, second);
+					std::swap(firstDistance, secondDistance);
+				}
+
+				// Children at least blend apart don't melt, past that the
+				// nearer one is the result
+				float blend = node.blend;
+				float near = this->evaluate(first, point, firstDistance, cutoff + blend, prune, evaluations);
+				float far = this->evaluate(second, point, secondDistance, fminf(cutoff, near) + blend, prune, evaluations);
+
+				float h = fmaxf(blend - fabsf(near - far), 0) / blend;
+				return raise(fminf(near, far) - h * h * blend * .25f, boundDistance);
+			}
+			default:
+				return boundDistance;
+			}
+		}
+
+		// Outside its bound a node is at least boundDistance away. Inside
+		// the bound is 0 and says nothing, raising an interior distance to
+		// it would no longer be a lower bound.
+		static float raise(float distance, float boundDistance) {
+			return boundDistance > 0 ? fmaxf(distance, boundDistance) : distance;
+		}
+
+		static std::atomic<bool>& pruningFlag() {
+			static std::atomic<bool> flag(true);
+			return flag;
+		}
+	};
+
+	// Shape evaluating tree, which it takes ownership of. The tree must be
+	// complete, nodes added later aren't covered by the bounds.
+	Shape* Combined(CSG* tree) {
+		Shape* s = new Shape();
+		s->field = std::shared_ptr<const DistanceField>(tree);
+		s->localBounds = tree->getBounds();
+		return s;
+	}
+}
@@ -1,11 +1,25 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <condition_variable>
+#include <limits>
+#include <memory>
+#include <mutex>
 #include <thread>;
+#include <vector>
 
-#include <SFML/Graphics.hpp>;
+#include <SFML/System.hpp>;
 #include "Rotation.hpp";
 #include "Scene.hpp";
 #include "Ray.hpp";
+#include "RayPacket.hpp"
+#include "ThreadPool.hpp"
+#include "TileQueue.hpp"
+#include "Passes.hpp"
+#include "RenderStats.hpp"
+#include "Detail.hpp"
 
 namespace Manta {
 
@@ -19,6 +33,16 @@ namespace Manta {
 
 
 
+	enum class Marching {
+		// Plain sphere tracing, every step covers the scene index
+		Standard,
+
+		// Over-relaxed sphere tracing (Keinert et al.), steps cover
+		// relaxation times the scene index and fall back to plain steps
+		// where that could skip a surface
+		Relaxed
+	};
+
 	class CameraData {
 	public:
 		sf::Vector3f position;
@@ -31,167 +55,396 @@ namespace Manta {
 
 		float fov = degToRad(45);
 
+		// Neighbouring primary rays marched together, 1 marches every ray on
+		// its own. Supported packet sizes are 4, 8 and 16.
+		unsigned int packetSize = 1;
+
+		// Pixels per unit of work handed to the render workers
+		sf::Vector2u tileSize = sf::Vector2u(32, 32);
+
+		// Renders every 4th pixel first and fills in the rest over two more
+		// passes, each coarse sample covers the pixels not traced yet
+		bool progressive = false;
+
+		// Used by primary and shadow rays. relaxation only applies to
+		// Marching::Relaxed, values in (1, 2) are useful.
+		Marching marching = Marching::Standard;
+		float relaxation = 1.2f;
+
+		// Primary rays start where a cone pre-pass found the first surface
+		// of their cell of coneCellSize x coneCellSize pixels. 0 starts
+		// every ray at the scene index of the camera position instead.
+		unsigned int coneCellSize = 4;
+
+		// Rays only march through the box around the scene, anything that
+		// leaves it can't hit a surface any more
+		bool clipToBounds = true;
+
+		// Warps the previous frame into the new view when only the camera
+		// moved and marches just the pixels it doesn't cover. Every
+		// reprojectionRefresh-th frame is marched in full so the small
+		// errors of warping don't pile up, 0 never does.
+		bool reprojection = false;
+		unsigned int reprojectionRefresh = 16;
+
+		// Ambient occlusion into Pass::AO from aoSamples scene index
+		// queries along the normal of every primary hit, spread evenly up to
+		// aoDistance, so it costs the same for every pixel. 0 samples leaves
+		// the pass unoccluded. aoHalfResolution only samples pixels with
+		// even coordinates and fills the others from the samples around
+		// them, weighted by depth when there is a depth pass.
+		unsigned int aoSamples = 0;
+		float aoDistance = 1;
+		bool aoHalfResolution = false;
+
+		// Fractal shapes stop refining detail smaller than detailPixels
+		// pixels at the distance a ray queries them from, see Detail. 0
+		// evaluates them at full detail everywhere.
+		float detailPixels = 1;
+
 		Scene* targetScene;
+
+		// Relaxation factor the rays of this frame march with
+		float getRelaxation() const {
+			return this->marching == Marching::Relaxed ? this->relaxation : 1;
+		}
 	};
 
 
 
-	class RenderHandler abstract {
+	class RenderHandler {
 	public:
+		// Side of the square blocks of pixels dirty flags are kept for
+		static const unsigned int DIRTY_TILE = 32;
+
 		sf::Uint8* getBitmap() { return this->bitmap; };
 
 		virtual void onStart() = 0;
 		virtual void onFinish() = 0;
 
+		// Called after every completed pass of a progressive render, the
+		// buffers hold a full (if coarse) frame at that point
+		virtual void onPass(unsigned int /*pass*/, unsigned int /*passCount*/) {}
+
+		// Called instead of onFinish() when a job was cancelled
+		virtual void onCancel() {}
+
+		// Called by the render worker that finished the rectangle. Nothing
+		// else writes these pixels until the next pass or frame starts. By
+		// default the rectangle gets flagged for the next composite().
+		virtual void onTile(unsigned int x, unsigned int y, unsigned int width, unsigned int height) {
+			this->markDirty(x, y, width, height);
+		}
+
+		// Flags the blocks touched by the rectangle as changed, parts
+		// outside the frame are ignored. Safe to call from render workers,
+		// the pixels written before are visible to whoever takes the flag.
+		void markDirty(unsigned int x, unsigned int y, unsigned int width, unsigned int height) {
+			unsigned int endX = std::min(x + width, this->cameraData->dimensions.x);
+			unsigned int endY = std::min(y + height, this->cameraData->dimensions.y);
+			if (x >= endX || y >= endY) return;
+
+			for (unsigned int ty = y / DIRTY_TILE; ty <= (endY - 1) / DIRTY_TILE; ty++) {
+				for (unsigned int tx = x / DIRTY_TILE; tx <= (endX - 1) / DIRTY_TILE; tx++) {
+					this->dirty[tx + ty * this->dirtyColumns].store(1, std::memory_order_release);
+				}
+			}
+		}
+
+		void markAllDirty() {
+			this->markDirty(0, 0, this->cameraData->dimensions.x, this->cameraData->dimensions.y);
+		}
+
 	protected:
 		sf::Uint8* bitmap;
 		CameraData* cameraData;
 
+		// One flag per DIRTY_TILE block in row order
+		std::unique_ptr<std::atomic<sf::Uint8>[]> dirty;
+		unsigned int dirtyColumns;
+		unsigned int dirtyRows;
+
 		RenderHandler(CameraData* cameraData) {
 			this->cameraData = cameraData;
 
-			this->bitmap = new sf::Uint8[cameraData->dimensions.x * cameraData->dimensions.y * 4];
+			this->bitmap = new sf::Uint8[cameraData->dimensions.x * cameraData->dimensions.y * 4]();
+
+			this->dirtyColumns = (cameraData->dimensions.x + DIRTY_TILE - 1) / DIRTY_TILE;
+			this->dirtyRows = (cameraData->dimensions.y + DIRTY_TILE - 1) / DIRTY_TILE;
+			this->dirty.reset(new std::atomic<sf::Uint8>[this->dirtyColumns * this->dirtyRows]);
+			for (unsigned int i = 0; i < this->dirtyColumns * this->dirtyRows; i++) this->dirty[i].store(0, std::memory_order_relaxed);
 		}
 
 		~RenderHandler() {
 			delete[] this->bitmap;
 		}
+
+		// Clears the flag of every dirty block and returns their indices
+		std::vector<unsigned int> takeDirty() {
+			std::vector<unsigned int> blocks;
+			for (unsigned int i = 0; i < this->dirtyColumns * this->dirtyRows; i++) {
+				if (this->dirty[i].load(std::memory_order_relaxed) && this->dirty[i].exchange(0, std::memory_order_acquire)) blocks.push_back(i);
+			}
+			return blocks;
+		}
+	};
+
+	// Channels of Pass::Cost, see MultipassRenderHandler::getPass()
+	enum class CostChannel {
+		PrimarySteps,
+		ShadowSteps,
+		DistanceEstimates
 	};
 
 	class MultipassRenderHandler : public RenderHandler {
 	public:
-		sf::Uint8* getAlbedo() { return this->albedo; };
-		sf::Uint16* getLightMap() { return this->light; };
+		static const unsigned int COST_CHANNELS = 3;
 
-		sf::Uint8* getMist() { return this->mist; };
-		sf::Uint8* getAO() { return this->ao; };
+		// Storage of pass, null unless it was requested. The camera only
+		// writes the passes that exist.
+		PassBuffer* getPass(Pass pass) { return this->passes[(unsigned int)pass].get(); };
 
-		virtual void onStart() = 0;
-		virtual void onFinish() = 0;
-
-	protected:
-		sf::Uint8* comp;
-
-		sf::Uint8* albedo;
-		sf::Uint16* light;
+		const PassRegistry& getRegistry() const { return this->registry; };
 
-		sf::Uint8* mist;
-		sf::Uint8* ao;
+		// Bytes held by all passes together
+		size_t memoryUsage() const {
+			size_t bytes = 0;
+			for (auto& pass : this->passes) if (pass) bytes += pass->memoryUsage();
+			return bytes;
+		}
 
+		virtual void onStart() = 0;
+		virtual void onFinish() = 0;
 
-		MultipassRenderHandler(CameraData* cameraData):
-		RenderHandler(cameraData) {
-			this->cameraData = cameraData;
+		// Albedo times light clamped to 1 into the bitmap, for the blocks
+		// marked dirty since the last call. With a pool the blocks are
+		// split among its workers. False if nothing changed. A missing
+		// albedo or light pass counts as 1.
+		bool composite(ThreadPool* pool = nullptr) {
+			std::vector<unsigned int> blocks = this->takeDirty();
+			this->compositeBlocks(blocks, pool);
+			return !blocks.empty();
+		}
 
-			this->comp = new sf::Uint8[cameraData->dimensions.x * cameraData->dimensions.y * 4];
+		// Mist fades the composite towards mistColor by mist times the mist
+		// pass, ao darkens it by ao times the occlusion in the AO pass (1 is
+		// unoccluded). Both 0 leave the plain composite, as does a pass that
+		// wasn't requested.
+		void setCompositeBlend(float mist, Color mistColor, float ao) {
+			this->mistAmount = mist;
+			this->mistColor = mistColor;
+			this->aoAmount = ao;
+			this->markAllDirty();
+		}
 
-			this->albedo = new sf::Uint8[cameraData->dimensions.x * cameraData->dimensions.y * 4];
-			this->light = new sf::Uint16[cameraData->dimensions.x * cameraData->dimensions.y * 4];
+		// False colour view of one cost channel into the bitmap. Log scaled
+		// against the most expensive pixel, black is free and white is
+		// the maximum.
+		void heatmap(CostChannel channel) {
+			unsigned int count = this->cameraData->dimensions.x * this->cameraData->dimensions.y;
 
-			this->mist = new sf::Uint8[cameraData->dimensions.x * cameraData->dimensions.y];
-			this->ao = new sf::Uint8[cameraData->dimensions.x * cameraData->dimensions.y];
+			std::vector<float> cost(count * COST_CHANNELS, 0.f);
+			if (this->getPass(Pass::Cost)) this->getPass(Pass::Cost)->unpack(0, count, cost.data(), COST_CHANNELS);
 
+			heatmap(channel, cost.data(), this->bitmap, count);
 		}
 
-		~MultipassRenderHandler() {
-			delete[] this->comp;
-			delete[] this->albedo;
-			delete[] this->light;
-			delete[] this->mist;
-			delete[] this->ao;
+	protected:
+		float mistAmount = 0;
+		Color mistColor;
+		float aoAmount = 0;
+
+		// heatmap() of count pixels of cost into the RGBA pixels of target
+		static void heatmap(CostChannel channel, const float* cost, sf::Uint8* target, unsigned int count) {
+			static const float RAMP[5][3] = {
+				{ 0, 0, 0 },
+				{ 40, 10, 160 },
+				{ 200, 30, 110 },
+				{ 255, 150, 0 },
+				{ 255, 255, 210 }
+			};
+
+			const float* values = &cost[(unsigned int)channel];
+
+			float largest = 1;
+			for (unsigned int i = 0; i < count; i++) largest = std::max(largest, values[i * COST_CHANNELS]);
+
+			float scale = 4 / logf(1.f + largest);
+
+			for (unsigned int i = 0; i < count; i++) {
+				float t = logf(1.f + values[i * COST_CHANNELS]) * scale;
+				unsigned int stop = std::min((unsigned int)t, 3u);
+				float blend = t - stop;
+
+				for (unsigned int c = 0; c < 3; c++) {
+					target[i * 4 + c] = (sf::Uint8)(RAMP[stop][c] + (RAMP[stop + 1][c] - RAMP[stop][c]) * blend);
+				}
+				target[i * 4 + 3] = 255;
+			}
 		}
-	};
-
 
-	class DirectRenderHandler : public RenderHandler {
-	public:
+		void compositeBlocks(const std::vector<unsigned int>& blocks, ThreadPool* pool) {
+			auto task = [this, &blocks](unsigned int i) { this->compositeBlock(blocks[i]); };
 
-		void update() {
-			this->tex.update(this->bitmap);
-			this->targetWindow->clear();
-			this->targetWindow->draw(sprite);
-			this->targetWindow->display();
+			if (pool) pool->parallelFor((unsigned int)blocks.size(), task);
+			else for (unsigned int i = 0; i < blocks.size(); i++) task(i);
 		}
 
-		void onFinish() override {
+		void compositeBlock(unsigned int block) {
+			unsigned int width = this->cameraData->dimensions.x;
+			unsigned int x0 = (block % this->dirtyColumns) * DIRTY_TILE;
+			unsigned int y0 = (block / this->dirtyColumns) * DIRTY_TILE;
 
+			this->compositeRect(
+				x0, y0,
+				std::min(x0 + DIRTY_TILE, width),
+				std::min(y0 + DIRTY_TILE, this->cameraData->dimensions.y),
+				&this->bitmap[(x0 + y0 * width) * 4], width
+			);
 		}
 
-		void onStart() override {
+		// Composites pixels [x0, x1) x [y0, y1) into out, whose rows are
+		// outWidth pixels apart. The passes get unpacked to contiguous RGB
+		// floats for the whole rectangle first, so the vector loads don't
+		// wait on the stores just made, then combined as one flat run and
+		// only spread to RGBA (alpha 255) as bytes.
+		void compositeRect(unsigned int x0, unsigned int y0, unsigned int x1, unsigned int y1, sf::Uint8* out, unsigned int outWidth) {
+			unsigned int width = this->cameraData->dimensions.x;
+			unsigned int columns = x1 - x0;
+			unsigned int count = columns * (y1 - y0) * 3;
+
+			const PassBuffer* albedoPass = this->getPass(Pass::Albedo);
+			const PassBuffer* lightPass = this->getPass(Pass::Light);
+			const PassBuffer* mistPass = this->mistAmount != 0 ? this->getPass(Pass::Mist) : nullptr;
+			const PassBuffer* aoPass = this->aoAmount != 0 ? this->getPass(Pass::AO) : nullptr;
+			bool blend = mistPass || aoPass;
+
+			// Unpacked passes, per channel scale and mist mix and the
+			// resulting colours of the rectangle. Used through plain
+			// pointers, byte stores could alias the vectors themselves.
+			thread_local std::vector<float> albedoRect;
+			thread_local std::vector<float> lightRect;
+			thread_local std::vector<float> scaleRect;
+			thread_local std::vector<float> mixRect;
+			thread_local std::vector<sf::Uint8> colorRect;
+			albedoRect.resize(count);
+			lightRect.resize(count);
+			colorRect.resize(count);
+			if (blend) {
+				scaleRect.resize(count);
+				mixRect.resize(count);
+			}
 
-		}
+			float* albedo = albedoRect.data();
+			float* light = lightRect.data();
+			float* scale = scaleRect.data();
+			float* mix = mixRect.data();
+			sf::Uint8* colors = colorRect.data();
+
+			for (unsigned int y = y0; y < y1; y++) {
+				unsigned int first = x0 + y * width;
+				unsigned int offset = (y - y0) * columns * 3;
+
+				// A missing pass counts as 1
+				if (albedoPass) albedoPass->unpack(first, columns, &albedo[offset], 3);
+				else std::fill(&albedo[offset], &albedo[offset + columns * 3], 1.f);
+				if (lightPass) lightPass->unpack(first, columns, &light[offset], 3);
+				else std::fill(&light[offset], &light[offset + columns * 3], 1.f);
+
+				if (!blend) continue;
+				for (unsigned int i = 0; i < columns; i++) {
+					float occlusion = aoPass ? this->aoAmount * (1 - aoPass->get(first + i, 0)) : 0;
+					float fog = mistPass ? this->mistAmount * mistPass->get(first + i, 0) : 0;
+
+					for (unsigned int c = 0; c < 3; c++) {
+						scale[offset + i * 3 + c] = 1 - occlusion;
+						mix[offset + i * 3 + c] = fog;
+					}
+				}
+			}
 
-		DirectRenderHandler(CameraData* cameraData, sf::RenderWindow* targetWindow) : RenderHandler(cameraData) {
-			this->targetWindow = targetWindow;
+			// mistColor repeated, so any offset into it starts at red
+			const sf::Uint8 channels[3] = { this->mistColor.r, this->mistColor.g, this->mistColor.b };
+			float target[3 + simd::WIDTH];
+			for (unsigned int i = 0; i < 3 + simd::WIDTH; i++) target[i] = channels[i % 3];
 
-			this->tex = sf::Texture();
+			// Adding .5 makes the truncation round, 1 * 255 must not come
+			// out as 254
+			const simd::vfloat half = simd::set(.5f);
+			const simd::vfloat full = simd::set(255);
+			const simd::vfloat one = simd::set(1);
 
-			sf::Vector2u wSize = targetWindow->getSize();
-			this->tex.create(wSize.x, wSize.y);
-			this->sprite = sf::Sprite();
-			this->sprite.setTexture(this->tex);
-		}
+			unsigned int i = 0;
+			for (; i + simd::WIDTH <= count; i += simd::WIDTH) {
+				simd::vfloat color = simd::mul(simd::mul(simd::min(simd::load(&light[i]), one), simd::load(&albedo[i])), full);
 
-	private:
-		sf::Texture tex;
-		sf::Sprite sprite;
-		sf::RenderWindow* targetWindow;
-	};
+				if (blend) {
+					color = simd::mul(color, simd::load(&scale[i]));
+					color = simd::add(color, simd::mul(simd::sub(simd::load(&target[i % 3]), color), simd::load(&mix[i])));
+				}
 
-	class DirectMultipassRenderHandler : public MultipassRenderHandler {
-	public:
+				simd::storeBytes(&colors[i], simd::add(color, half));
+			}
+
+			for (; i < count; i++) {
+				float color = std::min(light[i], 1.f) * albedo[i] * 255;
+				if (blend) {
+					color *= scale[i];
+					color += (target[i % 3] - color) * mix[i];
+				}
+				colors[i] = (sf::Uint8)std::min(std::max(color + .5f, 0.f), 255.f);
+			}
 
-		void update() {
-			for (unsigned int i = 0; i < this->cameraData->dimensions.x * this->cameraData->dimensions.y; i++) {
-				this->bitmap[i * 4] =
-					std::min(this->light[i * 4], (sf::Uint16)255)
-					* ((float)this->albedo[i * 4] / 255)
-					;
-				this->bitmap[i * 4 + 1] =
-					std::min(this->light[i * 4 + 1], (sf::Uint16)255)
-					* ((float)this->albedo[i * 4 + 1] / 255)
-					;
-				this->bitmap[i * 4 + 2] =
-					std::min(this->light[i * 4 + 2], (sf::Uint16)255)
-					* ((float)this->albedo[i * 4 + 2] / 255)
-					;
-				this->bitmap[i * 4 + 3] = 255;
+			for (unsigned int y = y0; y < y1; y++) {
+				simd::expandRGB(&colors[(y - y0) * columns * 3], &out[(y - y0) * outWidth * 4], columns);
 			}
-			
-			this->tex.update(this->bitmap);
-			this->targetWindow->clear();
-			this->targetWindow->draw(sprite);
-			this->targetWindow->display();
 		}
 
-		void onFinish() override {
+		PassRegistry registry;
 
-		}
+		// Indexed by Pass, null where it wasn't requested
+		std::unique_ptr<PassBuffer> passes[(unsigned int)Pass::Count];
 
-		void onStart() override {
+		MultipassRenderHandler(CameraData* cameraData, const PassRegistry& registry = PassRegistry::defaults()):
+		RenderHandler(cameraData) {
+			this->cameraData = cameraData;
+			this->registry = registry;
+
+			unsigned int count = cameraData->dimensions.x * cameraData->dimensions.y;
+			for (unsigned int i = 0; i < (unsigned int)Pass::Count; i++) {
+				Pass pass = (Pass)i;
+				if (!registry.has(pass)) continue;
+
+				this->passes[i].reset(new PassBuffer(count, PassRegistry::channels(pass), registry.format(pass), PassRegistry::byteScale(pass)));
+			}
 
+			// Escaped until something gets rendered
+			if (this->getPass(Pass::Depth)) this->getPass(Pass::Depth)->fill(std::numeric_limits<float>::infinity());
 		}
+	};
 
-		DirectMultipassRenderHandler(CameraData* cameraData, sf::RenderWindow* targetWindow):
-			MultipassRenderHandler(cameraData) {
-			this->targetWindow = targetWindow;
 
-			this->tex = sf::Texture();
 
-			sf::Vector2u wSize = targetWindow->getSize();
-			this->tex.create(wSize.x, wSize.y);
-			this->sprite = sf::Sprite();
-			this->sprite.setTexture(this->tex);
-		}
 
-	private:
-		sf::Texture tex;
-		sf::Sprite sprite;
-		sf::RenderWindow* targetWindow;
+	// Rectangle of pixels rendered as one unit of work
+	struct Tile {
+		unsigned int x;
+		unsigned int y;
+		unsigned int width;
+		unsigned int height;
 	};
 
+	// Distance every primary ray of a tile can skip, one per cell of
+	// cellSize x cellSize pixels in row order
+	struct TileDepths {
+		unsigned int cellSize = 1;
+		unsigned int columns = 0;
+		std::vector<float> depths;
 
-
+		float at(const Tile& tile, unsigned int x, unsigned int y) const {
+			return this->depths[(x - tile.x) / this->cellSize + (y - tile.y) / this->cellSize * this->columns];
+		}
+	};
 
 	class Camera {
 	public:
@@ -211,6 +464,19 @@ namespace Manta {
 			return straightForward;
 		}
 
+		// Inverse of getVector(), the factors of a normalized direction
+		static inline sf::Vector2f getFactors(sf::Vector3f direction, float fov, sf::Vector3f rotation) {
+			// Undo camera rotation
+			direction = rotateZ(&direction, -rotation.z);
+			direction = rotateX(&direction, -rotation.x);
+			direction = rotateY(&direction, -rotation.y);
+
+			float yAngle = asinf(std::max(-1.f, std::min(1.f, direction.y)));
+			float xAngle = atan2f(direction.z, direction.x);
+
+			return sf::Vector2f(xAngle * 2 / fov, yAngle * 2 / fov);
+		}
+
 		static inline sf::Vector2f fragToFactor(sf::Vector2i frag, sf::Vector2u dimensions) {
 			sf::Vector2f fFrag(frag.x, frag.y);
 			return sf::Vector2f(
@@ -218,270 +484,1142 @@ namespace Manta {
 				((float)((fFrag.y - dimensions.y / 2) / dimensions.x)) * 2
 			);
 		}
+
+		// Inverse of fragToFactor(), in continuous pixel coordinates
+		static inline sf::Vector2f factorToFrag(sf::Vector2f factor, sf::Vector2u dimensions) {
+			return sf::Vector2f(
+				factor.x * .5f * dimensions.x + dimensions.x / 2,
+				factor.y * .5f * dimensions.x + dimensions.y / 2
+			);
+		}
 		
-		virtual void render() = 0;
+		// Starts a render job in the background. A job still in flight gets
+		// cancelled, so after editing the CameraData call this again. The
+		// CameraData is copied right here, edits only count for the next job.
+		virtual void render() {
+			unsigned int job = ++this->generation;
+			CameraData data = *this->cameraData;
+
+			{
+				std::lock_guard<std::mutex> lock(this->managerMutex);
+				this->activeManagers++;
+			}
+
+			std::thread manager([this, job, data]() {
+				this->runJob(job, data);
+
+				std::lock_guard<std::mutex> lock(this->managerMutex);
+				this->activeManagers--;
+				this->managersDone.notify_all();
+			});
+			manager.detach();
+		}
+
+		// Renders a job and returns once it finished
+		void initWorkers() {
+			this->runJob(++this->generation, *this->cameraData);
+		}
+
+		// Stops the running job, tiles already being rendered still finish
+		void cancel() {
+			this->generation++;
+		}
+
+		// Cancels the running job and waits until no job is left. Every
+		// camera has to call it in its own destructor, jobs in flight call
+		// back into the derived class.
+		void stop() {
+			this->cancel();
+
+			std::unique_lock<std::mutex> lock(this->managerMutex);
+			this->managersDone.wait(lock, [this]() { return this->activeManagers == 0; });
+		}
+
+		// Covers the frame row by row, tiles at the right and bottom edge
+		// get cut to the frame
+		std::vector<Tile> getTiles() {
+			std::vector<Tile> tiles;
+
+			sf::Vector2u dimensions = this->frame.dimensions;
+			sf::Vector2u tileSize(
+				std::max(1u, std::min(this->frame.tileSize.x, dimensions.x)),
+				std::max(1u, std::min(this->frame.tileSize.y, dimensions.y))
+			);
+
+			for (unsigned int y = 0; y < dimensions.y; y += tileSize.y) {
+				for (unsigned int x = 0; x < dimensions.x; x += tileSize.x) {
+					tiles.push_back(Tile{
+						x, y,
+						std::min(tileSize.x, dimensions.x - x),
+						std::min(tileSize.y, dimensions.y - y)
+					});
+				}
+			}
+
+			return tiles;
+		}
 
 	protected:
 
-		Camera(CameraData* cameraData, RenderHandler* renderHandler) {
+		// nThreads = 0 starts one worker per hardware thread
+		Camera(CameraData* cameraData, RenderHandler* renderHandler, unsigned short nThreads) :
+		pool(nThreads) {
 			this->cameraData = cameraData;
 			this->renderHandler = renderHandler;
 		}
 
+		// Derived cameras are gone by now, they stop() before
+		virtual ~Camera() {}
+
+		// Renders rows [startRow, endRow) of column x
+		virtual void renderSpan(unsigned int x, unsigned int startRow, unsigned int endRow, float initialSceneIndex) = 0;
+
+		// Copies the pixel at (x, y) over the size x size block it samples
+		virtual void fillBlock(unsigned int x, unsigned int y, unsigned int size) = 0;
+
+		// Called by the worker that rendered tile in a pass with samples
+		// stride pixels apart, before the render handler gets the tile
+		virtual void finishTile(const Tile& /*tile*/, unsigned int /*stride*/) {}
+
+		// Warps the buffers of the previous frame into the view of this one
+		// and flags every pixel in pending (one per pixel, row order) that
+		// still has to be marched. False if there is nothing to warp, the
+		// whole frame gets marched then.
+		virtual bool reproject(const CameraData& /*previous*/, std::vector<sf::Uint8>* /*pending*/) {
+			return false;
+		}
+
+		void renderTile(const Tile& tile, const TileDepths& depths) {
+			for (unsigned int x = tile.x; x < tile.x + tile.width; x++) {
+				this->renderCells(tile, depths, x);
+			}
+		}
+
+		// Renders column x of the tile, one span per cell
+		void renderCells(const Tile& tile, const TileDepths& depths, unsigned int x) {
+			unsigned int endRow = tile.y + tile.height;
+
+			for (unsigned int y = tile.y; y < endRow; y += depths.cellSize) {
+				this->renderSpan(x, y, std::min(y + depths.cellSize, endRow), depths.at(tile, x, y));
+			}
+		}
+
+		// Marches only the pixels of the tile flagged in pending, one span
+		// per run of them inside a cell. Tiles without any skip the cone
+		// pre-pass as well.
+		void renderPending(const Tile& tile, float start, TileDepths* depths, const std::vector<sf::Uint8>& pending) {
+			unsigned int width = this->frame.dimensions.x;
+			unsigned int endColumn = tile.x + tile.width;
+			unsigned int endRow = tile.y + tile.height;
+
+			bool any = false;
+			for (unsigned int y = tile.y; y < endRow && !any; y++) {
+				for (unsigned int x = tile.x; x < endColumn && !any; x++) any = pending[x + y * width] != 0;
+			}
+			if (!any) return;
+
+			this->marchCones(tile, start, depths);
+
+			for (unsigned int x = tile.x; x < endColumn; x++) {
+				unsigned int y = tile.y;
+
+				while (y < endRow) {
+					if (!pending[x + y * width]) {
+						y++;
+						continue;
+					}
+
+					unsigned int cellEnd = std::min(endRow, y + depths->cellSize - (y - tile.y) % depths->cellSize);
+					unsigned int runEnd = y + 1;
+					while (runEnd < cellEnd && pending[x + runEnd * width]) runEnd++;
+
+					this->renderSpan(x, y, runEnd, depths->at(tile, x, y));
+					y = runEnd;
+				}
+			}
+		}
+
+		// Traces the pixels of the tile on the stride grid that are not on
+		// the grid of the previous pass (0 for the first pass). Samples sit
+		// on the frame wide grid, so a block may reach into the next tile,
+		// but every pixel still belongs to exactly one sample per pass.
+		void renderTileSamples(const Tile& tile, const TileDepths& depths, unsigned int stride, unsigned int previous) {
+			unsigned int endColumn = tile.x + tile.width;
+			unsigned int endRow = tile.y + tile.height;
+
+			unsigned int firstColumn = (tile.x + stride - 1) / stride * stride;
+			unsigned int firstRow = (tile.y + stride - 1) / stride * stride;
+
+			for (unsigned int x = firstColumn; x < endColumn; x += stride) {
+				bool previousColumn = previous != 0 && x % previous == 0;
+
+				// Nothing of this column was traced before
+				if (!previousColumn && stride == 1) {
+					this->renderCells(tile, depths, x);
+					continue;
+				}
+
+				for (unsigned int y = firstRow; y < endRow; y += stride) {
+					if (previousColumn && y % previous == 0) continue;
+
+					this->renderSpan(x, y, y + 1, depths.at(tile, x, y));
+					if (stride > 1) this->fillBlock(x, y, stride);
+				}
+			}
+		}
+
+		// Cone pre-pass of one tile. Marches one cone around all primary
+		// rays of the tile from start on until the scene gets closer than
+		// the cone is wide, then splits it into quarters that carry on from
+		// there, down to single cells.
+		void marchCones(const Tile& tile, float start, TileDepths* depths) {
+			// Cells at least as high as a packet, so spans still fill them
+			unsigned int cellSize = std::max(this->frame.coneCellSize, this->frame.packetSize);
+			if (this->frame.coneCellSize == 0) cellSize = std::max(tile.width, tile.height);
+
+			depths->cellSize = cellSize;
+			depths->columns = (tile.width + cellSize - 1) / cellSize;
+			depths->depths.assign(depths->columns * ((tile.height + cellSize - 1) / cellSize), start);
+
+			if (this->frame.coneCellSize == 0) return;
+
+			this->splitCone(tile, tile.x, tile.y, tile.x + tile.width, tile.y + tile.height, start, depths);
+		}
+
+		// Marches the cone of pixels [x0, x1) x [y0, y1) from t on and
+		// continues with its quarters
+		void splitCone(const Tile& tile, unsigned int x0, unsigned int y0, unsigned int x1, unsigned int y1, float t, TileDepths* depths) {
+			t = this->marchCone(x0, y0, x1, y1, t);
+
+			unsigned int cellSize = depths->cellSize;
+			unsigned int columns = (x1 - x0 + cellSize - 1) / cellSize;
+			unsigned int rows = (y1 - y0 + cellSize - 1) / cellSize;
+
+			if (columns == 1 && rows == 1) {
+				depths->depths[(x0 - tile.x) / cellSize + (y0 - tile.y) / cellSize * depths->columns] = t;
+				return;
+			}
+
+			// Halves in whole cells
+			unsigned int xs[3] = { x0, x0 + (columns + 1) / 2 * cellSize, x1 };
+			unsigned int ys[3] = { y0, y0 + (rows + 1) / 2 * cellSize, y1 };
+
+			for (unsigned int j = 0; j < 2; j++) {
+				for (unsigned int i = 0; i < 2; i++) {
+					if (xs[i] >= xs[i + 1] || ys[j] >= ys[j + 1]) continue;
+					this->splitCone(tile, xs[i], ys[j], xs[i + 1], ys[j + 1], t, depths);
+				}
+			}
+		}
+
+		// Distance the rays of pixels [x0, x1) x [y0, y1) can all skip,
+		// starting from t. A cone of half angle theta is k t = 2 sin(theta / 2) t
+		// wide at t, so a bound d on its axis lets every ray in it advance
+		// by (d - k t) / (1 + k). d is reduced by clampThreshold first, so
+		// no ray skips a point it would have stopped at on its own.
+		float marchCone(unsigned int x0, unsigned int y0, unsigned int x1, unsigned int y1, float t) {
+			sf::Vector2f first = fragToFactor(sf::Vector2i(x0, y0), this->frame.dimensions);
+			sf::Vector2f last = fragToFactor(sf::Vector2i(x1 - 1, y1 - 1), this->frame.dimensions);
+			sf::Vector2f center = (first + last) * .5f;
+
+			sf::Vector3f axis = getVector(center.x, center.y, this->frame.fov, this->frame.rotation);
+
+			// The widest ray sits on the rim of the pixel block
+			float smallestCos = 1;
+			for (float fx : { first.x, center.x, last.x }) {
+				for (float fy : { first.y, center.y, last.y }) {
+					sf::Vector3f direction = getVector(fx, fy, this->frame.fov, this->frame.rotation);
+					smallestCos = std::min(smallestCos, axis.x * direction.x + axis.y * direction.y + axis.z * direction.z);
+				}
+			}
+
+			// A little wider than needed, rounding must not make it too narrow
+			float angle = acosf(std::max(-1.f, std::min(1.f, smallestCos))) * 1.01f + 1e-4f;
+			float k = 2 * sinf(angle * .5f);
+
+			const unsigned int MAX_CONE_STEPS = 64;
+
+			for (unsigned int i = 0; i < MAX_CONE_STEPS && t < this->frame.maxDistance; i++) {
+				Detail::setFootprint(this->footprintAngle() * t);
+				float free = this->scene->sceneIndex(this->frame.position + axis * t) - this->frame.clampThreshold - k * t;
+				if (free < this->frame.clampThreshold) break;
+
+				t += free / (1 + k);
+			}
+
+			return t;
+		}
+
+		// Angle of one pixel scaled by detailPixels, times a distance it is
+		// the Detail footprint there
+		float footprintAngle() const {
+			return this->frame.detailPixels * this->frame.fov / this->frame.dimensions.x;
+		}
+
+		// Part [start, end) of a ray from origin that lies inside the scene
+		// bound and within maxDistance. False if there is none, the ray
+		// can't hit anything then.
+		bool clipToScene(sf::Vector3f origin, sf::Vector3f direction, float* start, float* end) {
+			if (!this->sceneBounds.intersect(origin, direction, start, end)) return false;
+
+			*start = std::max(*start, 0.f);
+			*end = std::min(*end, this->frame.maxDistance);
+			return *start < *end;
+		}
+
+		// Scene edits don't cancel, the job renders the snapshot it pinned
+		bool isCancelled(unsigned int job) {
+			return job != this->generation.load();
+		}
+
 		RenderHandler* renderHandler;
+
+		// Owned by the caller and free to change during a render
 		CameraData* cameraData;
-	};
 
-	class ThreadedCamera : public Camera {
-	public:
+		// Copy of cameraData the running job was started with, the workers
+		// only read this one
+		CameraData frame;
+		unsigned int frameRevision = 0;
 
-		void render() override {
-			std::thread manager(&ThreadedCamera::initWorkers, this);
-			manager.detach();
+		// Snapshot of frame.targetScene the running job renders, pinned
+		// until the next job starts
+		std::shared_ptr<const SceneSnapshot> scene;
+
+		// Scene bound of the running job, grown by clampThreshold since rays
+		// stop that far in front of a surface
+		Bounds sceneBounds;
+
+		// Kept alive between renders
+		ThreadPool pool;
+
+		// Last frame that finished, what reproject() warps from
+		CameraData previousFrame;
+		unsigned int previousRevision = 0;
+		bool hasPrevious = false;
+
+	private:
+		// Incremented for every new job, a job whose number is no longer
+		// current stops at the next tile
+		std::atomic<unsigned int> generation{ 0 };
+
+		// One job at a time, a new one waits for the cancelled one to drain
+		std::mutex jobMutex;
+
+		unsigned int activeManagers = 0;
+		std::mutex managerMutex;
+		std::condition_variable managersDone;
+
+		static unsigned int roundUp(unsigned int value, unsigned int multiple) {
+			return (value + multiple - 1) / multiple * multiple;
 		}
 
-		void initWorkers() {
-			unsigned int subframeWidth = this->cameraData->dimensions.x / this->nThreads;
+		// Frames warped since the last one marched in full
+		unsigned int reprojectedFrames = 0;
+
+		// Only the camera may have moved since the previous frame, anything
+		// else changes what the pixels see
+		bool canReproject() {
+			const CameraData& previous = this->previousFrame;
+
+			if (!this->frame.reprojection || !this->hasPrevious) return false;
+			if (this->frame.reprojectionRefresh != 0 && this->reprojectedFrames + 1 >= this->frame.reprojectionRefresh) return false;
+
+			return previous.targetScene == this->frame.targetScene &&
+				this->previousRevision == this->frameRevision &&
+				previous.dimensions == this->frame.dimensions &&
+				previous.fov == this->frame.fov &&
+				previous.maxDistance == this->frame.maxDistance &&
+				previous.clampThreshold == this->frame.clampThreshold &&
+				previous.aoSamples == this->frame.aoSamples &&
+				previous.aoDistance == this->frame.aoDistance &&
+				previous.aoHalfResolution == this->frame.aoHalfResolution &&
+				previous.detailPixels == this->frame.detailPixels;
+		}
+
+		void runJob(unsigned int job, const CameraData& data) {
+			std::lock_guard<std::mutex> lock(this->jobMutex);
+			if (job != this->generation.load()) return;
+
+			this->frame = data;
 
 			this->renderHandler->onStart();
 
-			std::vector<std::thread> workers;
+			// Edits made from here on go into the next snapshot
+			this->scene = this->frame.targetScene->prepare(&this->pool);
+			this->frameRevision = this->scene->getRevision();
 
-			float initialSceneIndex = this->cameraData->targetScene->sceneIndex(
-				this->cameraData->position,
-				this->cameraData->targetScene->getShapes()
-			);
+			const SceneSnapshot* scene = this->scene.get();
+			this->sceneBounds = this->frame.clipToBounds ?
+				scene->getBounds().expanded(this->frame.clampThreshold) :
+				Bounds::infinite();
 
-			for (unsigned short i = 0; i < this->nThreads; i++) {
-				unsigned int start = subframeWidth * i + (i > 0 ? 1 : 0);
-				unsigned int end = i == this->nThreads - 1 ?
-					this->cameraData->dimensions.x - 1 :
-					subframeWidth * (i + 1);
+			Detail::setFootprint(0);
+			float initialSceneIndex = std::max(0.f, scene->sceneIndex(this->frame.position));
 
-				workers.push_back(std::thread(&ThreadedCamera::renderSubframe, this, start, end, initialSceneIndex));
-				
-			}
+			std::vector<Tile> tiles = this->getTiles();
+			std::vector<TileDepths> depths(tiles.size());
+
+			// Pixels the warped previous frame doesn't cover
+			std::vector<sf::Uint8> pending;
+			bool reprojected = this->canReproject() && this->reproject(this->previousFrame, &pending);
+			if (reprojected) this->renderHandler->onTile(0, 0, this->frame.dimensions.x, this->frame.dimensions.y);
+			this->reprojectedFrames = reprojected ? this->reprojectedFrames + 1 : 0;
+
+			// Sample spacing of every pass, a warped frame is already a
+			// better preview than coarse samples
+			std::vector<unsigned int> strides;
+			if (this->frame.progressive && !reprojected) strides = { 4, 2, 1 };
+			else strides = { 1 };
+
+			for (unsigned int pass = 0; pass < strides.size(); pass++) {
+				unsigned int stride = strides[pass];
+				unsigned int previous = pass == 0 ? 0 : strides[pass - 1];
+
+				this->pool.parallelFor((unsigned int)tiles.size(), [&](unsigned int i) {
+					if (this->isCancelled(job)) return;
 
-			while (!workers.empty()) {
-				workers.back().join();
-				workers.pop_back();
+					if (reprojected) {
+						this->renderPending(tiles[i], initialSceneIndex, &depths[i], pending);
+					}
+					else {
+						if (pass == 0) this->marchCones(tiles[i], initialSceneIndex, &depths[i]);
+
+						if (previous == 0 && stride == 1) this->renderTile(tiles[i], depths[i]);
+						else this->renderTileSamples(tiles[i], depths[i], stride, previous);
+					}
+
+					this->finishTile(tiles[i], reprojected ? 1 : stride);
+
+					// Pixels filled by the samples of this tile, on the stride
+					// grid they may be shifted against the tile
+					unsigned int x0 = roundUp(tiles[i].x, stride);
+					unsigned int y0 = roundUp(tiles[i].y, stride);
+					unsigned int x1 = std::min(roundUp(tiles[i].x + tiles[i].width, stride), this->frame.dimensions.x);
+					unsigned int y1 = std::min(roundUp(tiles[i].y + tiles[i].height, stride), this->frame.dimensions.y);
+					if (x0 < x1 && y0 < y1) this->renderHandler->onTile(x0, y0, x1 - x0, y1 - y0);
+
+					if (RenderStats::isEnabled()) RenderStats::flush();
+				});
+
+				if (this->isCancelled(job)) {
+					// The buffers hold parts of two frames now
+					this->hasPrevious = false;
+					this->renderHandler->onCancel();
+					return;
+				}
+
+				this->renderHandler->onPass(pass, (unsigned int)strides.size());
 			}
 
+			this->previousFrame = this->frame;
+			this->previousRevision = this->frameRevision;
+			this->hasPrevious = true;
+
 			this->renderHandler->onFinish();
 		}
+	};
+
+	class ThreadedCamera : public Camera {
+	public:
 
-		sf::Color cast(sf::Vector2i pixelCoordinate) {
+		Color cast(sf::Vector2i pixelCoordinate) {
 			sf::Vector2f factor = fragToFactor(pixelCoordinate, this->cameraData->dimensions);
+			std::shared_ptr<const SceneSnapshot> scene = this->cameraData->targetScene->prepare();
 
-			Ray ray(this->cameraData->position, getVector(factor.x, factor.y, this->cameraData->fov, this->cameraData->rotation), this->cameraData->targetScene);
+			Ray ray(this->cameraData->position, getVector(factor.x, factor.y, this->cameraData->fov, this->cameraData->rotation), scene.get());
 
 			while (ray.step() > this->cameraData->clampThreshold) {
 				if (ray.distance >= this->cameraData->maxDistance) {
-					return this->cameraData->targetScene->getSkyColor();
+					return scene->getSkyColor();
 				}
 			}
-			return this->cameraData->targetScene->getColorAt(ray.getPosition());
+			return scene->getColorAt(ray.getPosition());
 		}
 
-		void renderSubframe(unsigned int startCol, unsigned int endCol, float initialSceneIndex) {
-			// Get bitmap
-			sf::Uint8* bitmap = this->renderHandler->getBitmap();
+		void renderSpan(unsigned int x, unsigned int startRow, unsigned int endRow, float initialSceneIndex) override {
+			// Single samples of a progressive pass gain nothing from packets
+			unsigned int packetSize = endRow - startRow > 1 ? this->frame.packetSize : 1;
 
-			// Render
-			for (unsigned int x = startCol; x <= endCol; x++) {
-				for (unsigned int y = 0; y < this->cameraData->dimensions.y; y++) {
-					unsigned int offset = x + y * this->cameraData->dimensions.x;
+			switch (packetSize) {
+			case 4: this->renderPacketColumn<4>(x, startRow, endRow, initialSceneIndex); break;
+			case 8: this->renderPacketColumn<8>(x, startRow, endRow, initialSceneIndex); break;
+			case 16: this->renderPacketColumn<16>(x, startRow, endRow, initialSceneIndex); break;
+			default: this->renderColumn(x, startRow, endRow, initialSceneIndex); break;
+			}
+		}
 
-					sf::Color frag;
+		// Renders rows [startRow, endRow) of column x
+		void renderColumn(unsigned int x, unsigned int startRow, unsigned int endRow, float initialSceneIndex) {
+			for (unsigned int y = startRow; y < endRow; y++) {
+				// Copied from cast()
+				sf::Vector2f factor = fragToFactor(sf::Vector2i(x, y), this->frame.dimensions);
 
-					// Copied from cast()
-					sf::Vector2f factor = fragToFactor(sf::Vector2i(x, y), this->cameraData->dimensions);
+				bool stats = RenderStats::isEnabled();
+				double start = stats ? RenderStats::now() : 0;
 
-					Ray ray(this->cameraData->position, getVector(factor.x, factor.y, this->cameraData->fov, this->cameraData->rotation), this->cameraData->targetScene);
+				sf::Vector3f direction = getVector(factor.x, factor.y, this->frame.fov, this->frame.rotation);
+				Ray ray(this->frame.position, direction, this->scene.get());
 
-					ray.manualStep(initialSceneIndex);
+				ray.manualStep(initialSceneIndex);
+				ray.setRelaxation(this->frame.getRelaxation());
+				ray.setFootprintAngle(this->footprintAngle());
 
-					while (ray.step() > this->cameraData->clampThreshold) {
-						if (ray.distance >= this->cameraData->maxDistance) {
-							frag = this->cameraData->targetScene->getSkyColor();
-							break;
-						}
+				float sceneStart, sceneEnd;
+				bool inside = this->clipToScene(this->frame.position, direction, &sceneStart, &sceneEnd);
+				if (inside && sceneStart > ray.distance) ray.manualStep(sceneStart - ray.distance);
+
+				bool hit = inside;
+				while (hit && ray.step() > this->frame.clampThreshold) {
+					if (ray.distance >= sceneEnd) {
+						hit = false;
+						break;
 					}
-					if (ray.distance < this->cameraData->maxDistance) frag = this->cameraData->targetScene->getColorAt(ray.getPosition());
-					// ----
+				}
+				// ----
 
+				if (stats) {
+					RenderStats::local().recordPrimary(ray.getSteps(), hit);
+					RenderStats::local().albedoSeconds += RenderStats::now() - start;
+				}
 
-					bitmap[offset * 4] = frag.r;
-					bitmap[offset * 4 + 1] = frag.g;
-					bitmap[offset * 4 + 2] = frag.b;
-					bitmap[offset * 4 + 3] = 255;
+				this->writeFragment(x + y * this->frame.dimensions.x, hit, ray.getPosition());
+			}
+		}
+
+		template<unsigned int N>
+		void renderPacketColumn(unsigned int x, unsigned int startRow, unsigned int endRow, float initialSceneIndex) {
+			sf::Vector3f directions[N];
+
+			for (unsigned int y = startRow; y < endRow; y += N) {
+				unsigned int count = std::min(N, endRow - y);
+
+				for (unsigned int i = 0; i < count; i++) {
+					sf::Vector2f factor = fragToFactor(sf::Vector2i(x, y + i), this->frame.dimensions);
+					directions[i] = getVector(factor.x, factor.y, this->frame.fov, this->frame.rotation);
+				}
+
+				bool stats = RenderStats::isEnabled();
+				double start = stats ? RenderStats::now() : 0;
+
+				RayPacket<N> packet(this->frame.position, directions, count, this->scene.get());
+
+				packet.manualStep(initialSceneIndex);
+				packet.setRelaxation(this->frame.getRelaxation());
+				packet.setFootprintAngle(this->footprintAngle());
+
+				for (unsigned int i = 0; i < count; i++) {
+					float sceneStart, sceneEnd;
+					if (this->clipToScene(this->frame.position, directions[i], &sceneStart, &sceneEnd)) packet.clip(i, sceneStart, sceneEnd);
+					else packet.clip(i, 0, 0);
+				}
+				packet.march(this->frame.clampThreshold, this->frame.maxDistance);
+
+				if (stats) {
+					for (unsigned int i = 0; i < count; i++) RenderStats::local().recordPrimary(packet.getSteps(i), packet.isHit(i));
+					RenderStats::local().albedoSeconds += RenderStats::now() - start;
+				}
+
+				for (unsigned int i = 0; i < count; i++) {
+					this->writeFragment(x + (y + i) * this->frame.dimensions.x, packet.isHit(i), packet.getPosition(i));
 				}
-				//std::cout << x << "(" << ((float)x) / this->cameraData->dimensions.x << "%)" << std::endl;
 			}
 		}
 
+		void writeFragment(unsigned int offset, bool hit, sf::Vector3f position) {
+			sf::Uint8* bitmap = this->renderHandler->getBitmap();
+
+			Color frag = hit ?
+				this->scene->getColorAt(position) :
+				this->scene->getSkyColor();
+
+			bitmap[offset * 4] = frag.r;
+			bitmap[offset * 4 + 1] = frag.g;
+			bitmap[offset * 4 + 2] = frag.b;
+			bitmap[offset * 4 + 3] = 255;
+		}
+
+		void fillBlock(unsigned int x, unsigned int y, unsigned int size) override {
+			sf::Uint8* bitmap = this->renderHandler->getBitmap();
+			unsigned int width = this->frame.dimensions.x;
+			unsigned int source = x + y * width;
 
+			unsigned int endColumn = std::min(x + size, width);
+			unsigned int endRow = std::min(y + size, this->frame.dimensions.y);
+
+			for (unsigned int row = y; row < endRow; row++) {
+				for (unsigned int column = x; column < endColumn; column++) {
+					unsigned int offset = column + row * width;
+					if (offset == source) continue;
+
+					for (unsigned int c = 0; c < 4; c++) bitmap[offset * 4 + c] = bitmap[source * 4 + c];
+				}
+			}
+		}
 
 
-		ThreadedCamera(CameraData* cameraData, RenderHandler* renderHandler, unsigned short nThreads):
-		Camera(cameraData, renderHandler) {
+
+
+		ThreadedCamera(CameraData* cameraData, RenderHandler* renderHandler, unsigned short nThreads = 0):
+		Camera(cameraData, renderHandler, nThreads) {
 			this->cameraData = cameraData;
 			this->renderHandler = renderHandler;
-
-			this->nThreads = nThreads;
 		}
 
-	protected:
-		unsigned short nThreads;
+		~ThreadedCamera() override {
+			this->stop();
+		}
 	};
 
 	class PBRCamera : public Camera {
 	public:
 
-		void render() override {
-			std::thread manager(&PBRCamera::initWorkers, this);
-			manager.detach();
-		}
+		Color cast(sf::Vector2i pixelCoordinate) {
+			sf::Vector2f factor = fragToFactor(pixelCoordinate, this->cameraData->dimensions);
+			std::shared_ptr<const SceneSnapshot> scene = this->cameraData->targetScene->prepare();
 
-		void initWorkers() {
-			unsigned int subframeWidth = this->cameraData->dimensions.x / this->nThreads;
+			Ray ray(this->cameraData->position, getVector(factor.x, factor.y, this->cameraData->fov, this->cameraData->rotation), scene.get());
 
-			this->renderHandler->onStart();
+			while (ray.step() > this->cameraData->clampThreshold) {
+				if (ray.distance >= this->cameraData->maxDistance) {
+					return scene->getSkyColor();
+				}
+			}
+			return scene->getColorAt(ray.getPosition());
+		}
 
-			std::vector<std::thread> workers;
+		void renderSpan(unsigned int x, unsigned int startRow, unsigned int endRow, float initialSceneIndex) override {
+			// Single samples of a progressive pass gain nothing from packets
+			unsigned int packetSize = endRow - startRow > 1 ? this->frame.packetSize : 1;
 
-			float initialSceneIndex = this->cameraData->targetScene->sceneIndex(
-				this->cameraData->position,
-				this->cameraData->targetScene->getShapes()
-			);
+			switch (packetSize) {
+			case 4: this->renderPacketColumn<4>(x, startRow, endRow, initialSceneIndex); break;
+			case 8: this->renderPacketColumn<8>(x, startRow, endRow, initialSceneIndex); break;
+			case 16: this->renderPacketColumn<16>(x, startRow, endRow, initialSceneIndex); break;
+			default: this->renderColumn(x, startRow, endRow, initialSceneIndex); break;
+			}
+		}
 
-			for (unsigned short i = 0; i < this->nThreads; i++) {
-				unsigned int start = subframeWidth * i + (i > 0 ? 1 : 0);
-				unsigned int end = i == this->nThreads - 1 ?
-					this->cameraData->dimensions.x - 1 :
-					subframeWidth * (i + 1);
+		// Renders rows [startRow, endRow) of column x
+		void renderColumn(unsigned int x, unsigned int startRow, unsigned int endRow, float initialSceneIndex) {
+			for (unsigned int y = startRow; y < endRow; y++) {
+				// Copied from cast()
+				sf::Vector2f factor = fragToFactor(sf::Vector2i(x, y), this->frame.dimensions);
+
+				bool stats = RenderStats::isEnabled();
+				double start = stats ? RenderStats::now() : 0;
+
+				sf::Vector3f direction = getVector(factor.x, factor.y, this->frame.fov, this->frame.rotation);
+				Ray ray(this->frame.position, direction, this->scene.get());
+
+				ray.manualStep(initialSceneIndex);
+				ray.setRelaxation(this->frame.getRelaxation());
+				ray.setFootprintAngle(this->footprintAngle());
+
+				float sceneStart, sceneEnd;
+				bool inside = this->clipToScene(this->frame.position, direction, &sceneStart, &sceneEnd);
+				if (inside && sceneStart > ray.distance) ray.manualStep(sceneStart - ray.distance);
+				bool albedoHit = inside;
+				while (albedoHit && ray.step() > this->frame.clampThreshold) {
+					if (ray.distance >= sceneEnd) {
+						albedoHit = false;
+						break;
+					}
+				}
+				// ----
 
-				workers.push_back(std::thread(&PBRCamera::renderSubframe, this, start, end, initialSceneIndex));
+				if (stats) {
+					RenderStats::local().recordPrimary(ray.getSteps(), albedoHit);
+					RenderStats::local().albedoSeconds += RenderStats::now() - start;
+				}
 
+				this->shadeFragment(
+					x + y * this->frame.dimensions.x,
+					albedoHit,
+					ray.getPosition(),
+					ray.distance,
+					ray.getClosestIndex(),
+					ray.getSteps(),
+					ray.getEstimates()
+				);
 			}
+		}
 
-			while (!workers.empty()) {
-				workers.back().join();
-				workers.pop_back();
-			}
+		template<unsigned int N>
+		void renderPacketColumn(unsigned int x, unsigned int startRow, unsigned int endRow, float initialSceneIndex) {
+			sf::Vector3f directions[N];
 
-			this->renderHandler->onFinish();
-		}
+			for (unsigned int y = startRow; y < endRow; y += N) {
+				unsigned int count = std::min(N, endRow - y);
 
-		sf::Color cast(sf::Vector2i pixelCoordinate) {
-			sf::Vector2f factor = fragToFactor(pixelCoordinate, this->cameraData->dimensions);
+				for (unsigned int i = 0; i < count; i++) {
+					sf::Vector2f factor = fragToFactor(sf::Vector2i(x, y + i), this->frame.dimensions);
+					directions[i] = getVector(factor.x, factor.y, this->frame.fov, this->frame.rotation);
+				}
 
-			Ray ray(this->cameraData->position, getVector(factor.x, factor.y, this->cameraData->fov, this->cameraData->rotation), this->cameraData->targetScene);
+				bool stats = RenderStats::isEnabled();
+				double start = stats ? RenderStats::now() : 0;
 
-			while (ray.step() > this->cameraData->clampThreshold) {
-				if (ray.distance >= this->cameraData->maxDistance) {
-					return this->cameraData->targetScene->getSkyColor();
+				RayPacket<N> packet(this->frame.position, directions, count, this->scene.get());
+
+				packet.manualStep(initialSceneIndex);
+				packet.setRelaxation(this->frame.getRelaxation());
+				packet.setFootprintAngle(this->footprintAngle());
+
+				for (unsigned int i = 0; i < count; i++) {
+					float sceneStart, sceneEnd;
+					if (this->clipToScene(this->frame.position, directions[i], &sceneStart, &sceneEnd)) packet.clip(i, sceneStart, sceneEnd);
+					else packet.clip(i, 0, 0);
+				}
+				packet.march(this->frame.clampThreshold, this->frame.maxDistance);
+
+				if (stats) {
+					for (unsigned int i = 0; i < count; i++) RenderStats::local().recordPrimary(packet.getSteps(i), packet.isHit(i));
+					RenderStats::local().albedoSeconds += RenderStats::now() - start;
+				}
+
+				for (unsigned int i = 0; i < count; i++) {
+					this->shadeFragment(
+						x + (y + i) * this->frame.dimensions.x,
+						packet.isHit(i),
+						packet.getPosition(i),
+						packet.getDistance(i),
+						packet.getClosestIndex(i),
+						packet.getSteps(i),
+						packet.getEstimates(i)
+					);
 				}
 			}
-			return this->cameraData->targetScene->getColorAt(ray.getPosition());
 		}
 
-		void renderSubframe(unsigned int startCol, unsigned int endCol, float initialSceneIndex) {
+		// Writes the requested passes for one primary ray result, cost only
+		// while RenderStats is enabled. Passes that don't exist cost
+		// nothing, without a light pass there is no shadow ray.
+		void shadeFragment(
+			unsigned int offset,
+			bool albedoHit,
+			sf::Vector3f position,
+			float distance,
+			unsigned int closestIndex,
+			unsigned int primarySteps,
+			unsigned int primaryEstimates
+		) {
 			// Pass RenderHandler
 			auto renderHandler = ((MultipassRenderHandler*)this->renderHandler);
 
-			// Get bitmap
-			sf::Uint8* albedo = renderHandler->getAlbedo();
+			// Normal, shadow ray and AO see the surface at the detail of its
+			// pixel
+			Detail::setFootprint(albedoHit ? this->footprintAngle() * distance : 0);
 
-			// Render
-			for (unsigned int x = startCol; x <= endCol; x++) {
-				for (unsigned int y = 0; y < this->cameraData->dimensions.y; y++) {
-					unsigned int offset = x + y * this->cameraData->dimensions.x;
+			// Set albedo fragment
+			if (PassBuffer* albedo = renderHandler->getPass(Pass::Albedo)) {
+				Color frag = albedoHit ?
+					this->scene->getColorAt(position) :
+					this->scene->getSkyColor();
 
-					sf::Color frag;
+				albedo->set(offset, 0, frag.r / 255.f);
+				albedo->set(offset, 1, frag.g / 255.f);
+				albedo->set(offset, 2, frag.b / 255.f);
+			}
+
+			// Set mist fragment
+			if (PassBuffer* mist = renderHandler->getPass(Pass::Mist)) {
+				float depth = albedoHit ? distance : this->frame.maxDistance;
+				mist->set(offset, 0, fminf(depth / this->frame.maxDistance, 1));
+			}
 
-					// Copied from cast()
-					sf::Vector2f factor = fragToFactor(sf::Vector2i(x, y), this->cameraData->dimensions);
+			if (PassBuffer* depth = renderHandler->getPass(Pass::Depth)) {
+				depth->set(offset, 0, albedoHit ? distance : std::numeric_limits<float>::infinity());
+			}
 
-					Ray ray(this->cameraData->position, getVector(factor.x, factor.y, this->cameraData->fov, this->cameraData->rotation), this->cameraData->targetScene);
+			if (PassBuffer* positions = renderHandler->getPass(Pass::Position)) {
+				positions->set(offset, 0, position.x);
+				positions->set(offset, 1, position.y);
+				positions->set(offset, 2, position.z);
+			}
 
-					ray.manualStep(initialSceneIndex);
-					bool albedoHit = true;
+			bool stats = RenderStats::isEnabled();
+			unsigned int shadowSteps = 0;
+			unsigned int shadowEstimates = 0;
+
+			PassBuffer* lightMap = renderHandler->getPass(Pass::Light);
+			PassBuffer* normals = renderHandler->getPass(Pass::Normal);
+			PassBuffer* ao = renderHandler->getPass(Pass::AO);
+
+			// Pixels half resolution AO skips get filled by finishTile()
+			unsigned int x = offset % this->frame.dimensions.x;
+			unsigned int y = offset / this->frame.dimensions.x;
+			bool aoSampled = ao && this->frame.aoSamples > 0 && (!this->frame.aoHalfResolution || (x % 2 == 0 && y % 2 == 0));
+
+			// One normal for every pass that needs it
+			sf::Vector3f normal;
+			if (albedoHit && (lightMap || normals || aoSampled)) normal = this->hitNormal(position, closestIndex);
+
+			// Set light fragment
+			if (lightMap) {
+				// Ambient, 255 is full intensity
+				float light[3] = {20, 20, 20};
+
+				// Surfaces facing away from the light shadow themselves, so
+				// they need no shadow ray
+				sf::Vector3f direction = this->scene->getGlobalLight().direction;
+				float lambert = 0;
+				if (albedoHit) {
+					float length = sqrtf(direction.x * direction.x + direction.y * direction.y + direction.z * direction.z);
+					lambert = -(normal.x * direction.x + normal.y * direction.y + normal.z * direction.z) / length;
+				}
 
-					while (ray.step() > this->cameraData->clampThreshold) {
-						if (ray.distance >= this->cameraData->maxDistance) {
-							frag = this->cameraData->targetScene->getSkyColor();
-							albedoHit = false;
+				if (lambert > 0) {
+					// Check if globalLight is occluded (direct shadow)
+					double start = stats ? RenderStats::now() : 0;
+
+					LightRay globalLightRay(position, -direction, this->scene.get());
+					globalLightRay.setRelaxation(this->frame.getRelaxation());
+
+					//globalLightRay.manualStep(this->frame.clampThreshold);
+
+					// The hit lies inside the scene bound, so only the exit matters
+					float sceneStart, sceneEnd;
+					if (!this->clipToScene(position, -direction, &sceneStart, &sceneEnd)) sceneEnd = 0;
+
+					bool globalLightOccluded = sceneEnd > 0;
+					while (globalLightOccluded && globalLightRay.step(closestIndex) >= this->frame.clampThreshold) {
+						if (globalLightRay.distance >= sceneEnd) {
+							globalLightOccluded = false;
 							break;
 						}
 					}
-					if (albedoHit) frag = this->cameraData->targetScene->getColorAt(ray.getPosition());
-					// ----
-
-					// Set albedo fragment
-					albedo[offset * 4] = frag.r;
-					albedo[offset * 4 + 1] = frag.g;
-					albedo[offset * 4 + 2] = frag.b;
-					albedo[offset * 4 + 3] = 255;
-
-					// Set mist fragment
-					renderHandler->getMist()[offset] = (sf::Uint8)fmin((ray.distance / this->cameraData->maxDistance) * 255, 255);
-				
-					// Set light fragment
-					sf::Uint16* lightMap = renderHandler->getLightMap();
-
-					sf::Uint16 light[3] = {20, 20, 20};
-
-					bool globalLightOccluded = true;
-					if (albedoHit) {
-						// Check if globalLight is occluded (direct shadow)
-						sf::Vector3f direction = this->cameraData->targetScene->globalLight.direction;
-
-						LightRay globalLightRay(ray.getPosition(), -direction, this->cameraData->targetScene);
-						
-						if (ray.getPosition().y < 0.0) {
-							//Catcher
-							int lool = 10;
-						}
 
-						//globalLightRay.manualStep(this->cameraData->clampThreshold);
-						
-						while (globalLightRay.step(ray.getClosestIndex()) >= this->cameraData->clampThreshold) {
-							if (globalLightRay.distance >= this->cameraData->maxDistance) {
-								globalLightOccluded = false;
-								break;
+					if (stats) {
+						RenderStats::local().recordShadow(globalLightRay.getSteps(), globalLightOccluded);
+						RenderStats::local().shadowSeconds += RenderStats::now() - start;
+
+						shadowSteps = globalLightRay.getSteps();
+						shadowEstimates = globalLightRay.getEstimates();
+					}
+
+					if (!globalLightOccluded) {
+						const GlobalLight* globalLight = &this->scene->getGlobalLight();
+						float intensity = globalLight->getIntensity() * lambert;
+						light[0] += globalLight->getColor().r * intensity;
+						light[1] += globalLight->getColor().g * intensity;
+						light[2] += globalLight->getColor().b * intensity;
+					}
+				}
+
+				for (unsigned int c = 0; c < 3; c++) lightMap->set(offset, c, light[c] / 255);
+			}
+
+			if (normals) {
+				normals->set(offset, 0, normal.x);
+				normals->set(offset, 1, normal.y);
+				normals->set(offset, 2, normal.z);
+			}
+
+			if (ao) {
+				if (!albedoHit || this->frame.aoSamples == 0) ao->set(offset, 0, 1);
+				else if (aoSampled) ao->set(offset, 0, this->ambientOcclusion(position, normal));
+			}
+
+			PassBuffer* cost = renderHandler->getPass(Pass::Cost);
+			if (stats && cost) {
+				cost->set(offset, (unsigned int)CostChannel::PrimarySteps, (float)primarySteps);
+				cost->set(offset, (unsigned int)CostChannel::ShadowSteps, (float)shadowSteps);
+				cost->set(offset, (unsigned int)CostChannel::DistanceEstimates, (float)(primaryEstimates + shadowEstimates));
+			}
+		}
+
+		// Normal of the hit shape alone, none of the other shapes get
+		// evaluated
+		sf::Vector3f hitNormal(sf::Vector3f position, unsigned int closestIndex) {
+			return this->scene->getShape(closestIndex).normal(position, this->frame.clampThreshold);
+		}
+
+		// Unoccluded fraction around a hit, from the scene index at
+		// aoSamples points along its normal. A point closer to some surface
+		// than to the hit is occluded by the difference, near points count
+		// twice as much as the next one out.
+		float ambientOcclusion(sf::Vector3f position, sf::Vector3f normal) {
+			bool stats = RenderStats::isEnabled();
+			double start = stats ? RenderStats::now() : 0;
+
+			float occlusion = 0;
+			float total = 0;
+			float weight = 1;
+
+			for (unsigned int i = 1; i <= this->frame.aoSamples; i++) {
+				float height = this->frame.aoDistance * i / this->frame.aoSamples;
+				float distance = this->scene->sceneIndex(position + normal * height);
+
+				occlusion += (height - std::max(distance, 0.f)) * weight;
+				total += height * weight;
+				weight *= .5f;
+			}
+
+			if (stats) RenderStats::local().aoSeconds += RenderStats::now() - start;
+
+			return 1 - std::min(std::max(occlusion / total, 0.f), 1.f);
+		}
+
+		// Half resolution AO of the pixels with an odd coordinate, from the
+		// sampled pixels next to them inside the tile. Samples at about the
+		// depth of the pixel count the most, so occlusion doesn't bleed
+		// across silhouettes.
+		void finishTile(const Tile& tile, unsigned int stride) override {
+			if (stride != 1 || !this->frame.aoHalfResolution || this->frame.aoSamples == 0) return;
+
+			auto renderHandler = ((MultipassRenderHandler*)this->renderHandler);
+			PassBuffer* ao = renderHandler->getPass(Pass::AO);
+			PassBuffer* depth = renderHandler->getPass(Pass::Depth);
+			if (!ao) return;
+
+			unsigned int width = this->frame.dimensions.x;
+			unsigned int endX = std::min(tile.x + tile.width, width);
+			unsigned int endY = std::min(tile.y + tile.height, this->frame.dimensions.y);
+
+			for (unsigned int y = tile.y; y < endY; y++) {
+				for (unsigned int x = tile.x; x < endX; x++) {
+					if (x % 2 == 0 && y % 2 == 0) continue;
+
+					unsigned int offset = x + y * width;
+					float pixelDepth = depth ? depth->get(offset, 0) : 0;
+					if (!(pixelDepth < std::numeric_limits<float>::infinity())) continue;
+
+					// The sampled pixels around this one, one or both
+					// coordinates odd means two or four
+					unsigned int columns[2] = { x % 2 ? x - 1 : x, x % 2 ? x + 1 : x };
+					unsigned int rows[2] = { y % 2 ? y - 1 : y, y % 2 ? y + 1 : y };
+
+					float sum = 0;
+					float weights = 0;
+
+					for (unsigned int row : rows) {
+						for (unsigned int column : columns) {
+							if (column < tile.x || column >= endX || row < tile.y || row >= endY) continue;
+
+							unsigned int sample = column + row * width;
+							float weight = 1;
+
+							if (depth) {
+								float sampleDepth = depth->get(sample, 0);
+								if (!(sampleDepth < std::numeric_limits<float>::infinity())) continue;
+								weight = 1 / (.01f + fabsf(sampleDepth - pixelDepth) / pixelDepth);
 							}
-						}
 
-						if (!globalLightOccluded) {
-							GlobalLight* globalLight = &this->cameraData->targetScene->globalLight;
-							light[0] += globalLight->getColor().r * globalLight->getIntensity();
-							light[1] += globalLight->getColor().g * globalLight->getIntensity();
-							light[2] += globalLight->getColor().b * globalLight->getIntensity();
+							sum += ao->get(sample, 0) * weight;
+							weights += weight;
 						}
 					}
 
-					lightMap[offset * 4] = light[0];
-					lightMap[offset * 4 + 1] = light[1];
-					lightMap[offset * 4 + 2] = light[2];
-					lightMap[offset * 4 + 3] = 255;
+					ao->set(offset, 0, weights > 0 ? sum / weights : 1);
 				}
-				//std::cout << x << "(" << ((float)x) / this->cameraData->dimensions.x << "%)" << std::endl;
 			}
 		}
 
+		void fillBlock(unsigned int x, unsigned int y, unsigned int size) override {
+			auto renderHandler = ((MultipassRenderHandler*)this->renderHandler);
+
+			unsigned int width = this->frame.dimensions.x;
+			unsigned int source = x + y * width;
+
+			unsigned int endColumn = std::min(x + size, width);
+			unsigned int endRow = std::min(y + size, this->frame.dimensions.y);
+
+			for (unsigned int i = 0; i < (unsigned int)Pass::Count; i++) {
+				PassBuffer* pass = renderHandler->getPass((Pass)i);
+				if (!pass) continue;
+
+				for (unsigned int row = y; row < endRow; row++) {
+					for (unsigned int column = x; column < endColumn; column++) {
+						unsigned int offset = column + row * width;
+						if (offset != source) pass->copy(offset, source);
+					}
+				}
+			}
+		}
+
+
+
+
+		// Moves every hit of the previous frame to the pixel it lands on
+		// from the new camera. Where several land on one pixel the closest
+		// wins, or among hits on about the same surface the one nearest the
+		// pixel center, so samples don't wander off over frames. Pixels
+		// nothing landed on were hidden or out of view before, and a hit
+		// much farther away than one of its neighbours most likely shows
+		// through a gap in the surface in front, both get marched again.
+		// Escaped rays are not warped, rays that miss the scene bound cost
+		// no steps anyway. Needs the depth and position passes.
+		bool reproject(const CameraData& /*previous*/, std::vector<sf::Uint8>* pending) override {
+			auto renderHandler = ((MultipassRenderHandler*)this->renderHandler);
+
+			PassBuffer* depthPass = renderHandler->getPass(Pass::Depth);
+			PassBuffer* positions = renderHandler->getPass(Pass::Position);
+			if (!depthPass || !positions) return false;
+
+			unsigned int width = this->frame.dimensions.x;
+			unsigned int height = this->frame.dimensions.y;
+			unsigned int count = width * height;
+
+			const unsigned int NONE = UINT_MAX;
+
+			// Relative difference in depth where hits stop counting as the
+			// same surface
+			const float GAP = .1f;
+
+			this->targets.assign(count, NONE);
+			this->fragments.resize(count);
+			this->targetDepths.resize(count);
+
+			// Where each hit lands, rows in parallel
+			this->pool.parallelFor(height, [&](unsigned int y) {
+				for (unsigned int x = 0; x < width; x++) {
+					unsigned int offset = x + y * width;
+					if (!(depthPass->get(offset, 0) < std::numeric_limits<float>::infinity())) continue;
+
+					sf::Vector3f toHit = sf::Vector3f(positions->get(offset, 0), positions->get(offset, 1), positions->get(offset, 2)) - this->frame.position;
+					float distance = sqrtf(toHit.x * toHit.x + toHit.y * toHit.y + toHit.z * toHit.z);
+					if (distance <= this->frame.clampThreshold) continue;
+
+					sf::Vector2f frag = factorToFrag(getFactors(toHit / distance, this->frame.fov, this->frame.rotation), this->frame.dimensions);
+					sf::Vector2f pixel(floorf(frag.x + .5f), floorf(frag.y + .5f));
+					if (!(pixel.x >= 0 && pixel.y >= 0 && pixel.x < width && pixel.y < height)) continue;
+
+					this->targets[offset] = (unsigned int)pixel.x + (unsigned int)pixel.y * width;
+					this->fragments[offset] = frag;
+					this->targetDepths[offset] = distance;
+				}
+			});
+
+			// Every pass that moves with its hit, copied so the warp reads
+			// the old frame while writing the new one
+			this->warped.clear();
+			for (Pass pass : { Pass::Albedo, Pass::Light, Pass::AO, Pass::Position, Pass::Normal }) {
+				if (renderHandler->getPass(pass)) this->warped.push_back(renderHandler->getPass(pass));
+			}
+			if (this->previousPasses.size() != this->warped.size()) this->previousPasses.clear();
+			for (unsigned int i = 0; i < this->warped.size(); i++) {
+				if (i < this->previousPasses.size()) this->previousPasses[i] = *this->warped[i];
+				else this->previousPasses.push_back(*this->warped[i]);
+			}
+
+			pending->assign(count, 1);
+			this->depths.assign(count, std::numeric_limits<float>::infinity());
+			this->landed.assign(count, NONE);
+
+			// Squared distance of a hit from the center of pixel target
+			auto offsetOf = [&](unsigned int source, unsigned int target) {
+				float dx = this->fragments[source].x - (target % width);
+				float dy = this->fragments[source].y - (target / width);
+				return dx * dx + dy * dy;
+			};
+
+			// Puts hit source on pixel target if it beats what landed there
+			auto land = [&](unsigned int source, unsigned int target) {
+				float distance = this->targetDepths[source];
+				unsigned int current = this->landed[target];
+
+				if (current != NONE) {
+					bool closer = distance < this->depths[target] * (1 - GAP);
+					bool sameSurface = distance < this->depths[target] * (1 + GAP) && offsetOf(source, target) < offsetOf(current, target);
+					if (!closer && !sameSurface) return;
+				}
+
+				this->depths[target] = distance;
+				for (unsigned int i = 0; i < this->warped.size(); i++) this->warped[i]->copy(target, this->previousPasses[i], source);
+
+				this->landed[target] = source;
+				(*pending)[target] = 0;
+			};
+
+			for (unsigned int source = 0; source < count; source++) {
+				if (this->targets[source] != NONE) land(source, this->targets[source]);
+			}
+
+			// Hits that lost their pixel fill an empty neighbour within one
+			// pixel instead, otherwise holes keep growing wherever the view
+			// stretches
+			for (unsigned int source = 0; source < count; source++) {
+				unsigned int target = this->targets[source];
+				if (target == NONE || this->landed[target] == source) continue;
+
+				unsigned int x = target % width;
+				unsigned int y = target / width;
+
+				unsigned int best = NONE;
+				float bestOffset = 1;
 
+				for (unsigned int ny = y > 0 ? y - 1 : 0; ny <= std::min(y + 1, height - 1); ny++) {
+					for (unsigned int nx = x > 0 ? x - 1 : 0; nx <= std::min(x + 1, width - 1); nx++) {
+						unsigned int neighbour = nx + ny * width;
+						if (this->landed[neighbour] != NONE) continue;
 
+						float offset = offsetOf(source, neighbour);
+						if (offset < bestOffset) {
+							best = neighbour;
+							bestOffset = offset;
+						}
+					}
+				}
+
+				if (best != NONE) land(source, best);
+			}
+
+			PassBuffer* mist = renderHandler->getPass(Pass::Mist);
 
-		PBRCamera(CameraData* cameraData, MultipassRenderHandler* renderHandler, unsigned short nThreads) :
-		Camera(cameraData, renderHandler) {
+			// A hit far behind a neighbour most likely shows through a gap
+			// between the samples of the surface in front
+			for (unsigned int y = 0; y < height; y++) {
+				for (unsigned int x = 0; x < width; x++) {
+					unsigned int offset = x + y * width;
+					depthPass->set(offset, 0, this->depths[offset]);
+					if ((*pending)[offset]) continue;
+
+					float limit = this->depths[offset] * (1 - GAP);
+					bool gap = false;
+
+					for (unsigned int ny = y > 0 ? y - 1 : 0; ny <= std::min(y + 1, height - 1) && !gap; ny++) {
+						for (unsigned int nx = x > 0 ? x - 1 : 0; nx <= std::min(x + 1, width - 1) && !gap; nx++) {
+							gap = this->depths[nx + ny * width] < limit;
+						}
+					}
+
+					if (gap) (*pending)[offset] = 1;
+					else if (mist) mist->set(offset, 0, fminf(this->depths[offset] / this->frame.maxDistance, 1));
+				}
+			}
+
+			// Warped pixels cost nothing this frame
+			if (renderHandler->getPass(Pass::Cost)) renderHandler->getPass(Pass::Cost)->fill(0);
+
+			if (RenderStats::isEnabled()) {
+				for (unsigned int i = 0; i < count; i++) {
+					if (!(*pending)[i]) RenderStats::local().reprojectedPixels++;
+				}
+				RenderStats::flush();
+			}
+
+			return true;
+		}
+
+		PBRCamera(CameraData* cameraData, MultipassRenderHandler* renderHandler, unsigned short nThreads = 0) :
+		Camera(cameraData, renderHandler, nThreads) {
 			this->cameraData = cameraData;
 			this->renderHandler = renderHandler;
+		}
 
-			this->nThreads = nThreads;
+		~PBRCamera() override {
+			this->stop();
 		}
 
-	protected:
-		unsigned short nThreads;
+	private:
+		// Scratch space of reproject(), kept between frames
+		std::vector<unsigned int> targets;
+		std::vector<sf::Vector2f> fragments;
+		std::vector<float> targetDepths;
+		std::vector<unsigned int> landed;
+		std::vector<float> depths;
+		std::vector<PassBuffer*> warped;
+		std::vector<PassBuffer> previousPasses;
 	};
 }
\ No newline at end of file
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <SFML/System.hpp>
+
+namespace Manta {
+
+	// 8 bit RGBA colour with the layout of sf::Color, which is part of the
+	// SFML graphics module the headless tools don't link
+	struct Color {
+		sf::Uint8 r = 0;
+		sf::Uint8 g = 0;
+		sf::Uint8 b = 0;
+		sf::Uint8 a = 255;
+
+		Color() {}
+
+		Color(sf::Uint8 r, sf::Uint8 g, sf::Uint8 b, sf::Uint8 a = 255) {
+			this->r = r;
+			this->g = g;
+			this->b = b;
+			this->a = a;
+		}
+	};
+}
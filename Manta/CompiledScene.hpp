@@ -0,0 +1,222 @@
+#pragma once
+
+#include <climits>
+#include <limits>
+#include <memory>
+#include <vector>
+
+#include <SFML/System.hpp>
+
+#include "Shape.hpp"
+#include "Transform.hpp"
+#include "Simd.hpp"
+
+namespace Manta {
+
+	// Flattened copy of a scene's shapes. Baked primitives are grouped by
+	// type into structure of arrays so one vector instruction evaluates
+	// simd::WIDTH shapes at once, everything else is evaluated through
+	// Shape::distanceEstimate like before.
+	class CompiledScene {
+	public:
+
+		// Lanes hold scene indices as float, which is exact up to 2^24.
+		// Larger scenes can't be compiled.
+		static const unsigned int MAX_SHAPES = 1u << 24;
+
+		static bool supports(size_t shapeCount) {
+			return shapeCount <= MAX_SHAPES;
+		}
+
+		// Only for scenes supports() accepts
+		void build(const std::vector<Shape>& shapes) {
+			this->spheres.clear();
+			this->boxes.clear();
+			this->generic.clear();
+			this->genericIndices.clear();
+
+			for (unsigned int i = 0; i < shapes.size(); i++) {
+				const Shape* shape = &shapes[i];
+
+				switch (shape->getPrimitive()) {
+				case Primitive::Sphere:
+					this->spheres.push(shape->getBakedTransform(), shape->getBakedScale(), i);
+					break;
+				case Primitive::Box:
+					this->boxes.push(shape->getBakedTransform(), shape->getBakedScale(), i);
+					break;
+				default:
+					this->generic.push_back(shape);
+					this->genericIndices.push_back(i);
+				}
+			}
+
+			this->shapeCount = (unsigned int)shapes.size();
+
+			this->spheres.pad();
+			this->boxes.pad();
+		}
+
+		// Smallest distance estimate and the scene index of the shape it
+		// belongs to. ignoredIndex is skipped, pass UINT_MAX to use all.
+		// outIndex has to be valid (or UINT_MAX) on entry.
+		float nearest(const sf::Vector3f input, unsigned int* outIndex, unsigned int ignoredIndex) const {
+			float smallest = std::numeric_limits<float>::infinity();
+
+			this->nearestSphere(input, ignoredIndex, &smallest, outIndex);
+			this->nearestBox(input, ignoredIndex, &smallest, outIndex);
+
+			for (unsigned int i = 0; i < this->generic.size(); i++) {
+				if (this->genericIndices[i] == ignoredIndex) continue;
+
+				float current = this->generic[i]->distanceEstimate(input, smallest);
+				if (current < smallest || (current == smallest && this->genericIndices[i] < *outIndex)) {
+					smallest = current;
+					*outIndex = this->genericIndices[i];
+				}
+			}
+
+			return smallest;
+		}
+
+		// Shapes evaluated per query, padding lanes not included
+		unsigned int size() const {
+			return this->shapeCount;
+		}
+
+	private:
+		// One primitive type with the baked matrix of every shape split into
+		// one array per element. Padding lanes sit far away so they never win.
+		struct Group {
+			std::vector<float> m[12];
+			std::vector<float> scale;
+
+			// Scene index of every lane as float, see MAX_SHAPES
+			std::vector<float> index;
+
+			void clear() {
+				for (auto& element : this->m) element.clear();
+				this->scale.clear();
+				this->index.clear();
+			}
+
+			void push(const Affine& transform, float scale, unsigned int sceneIndex) {
+				for (int i = 0; i < 12; i++) this->m[i].push_back(transform.m[i]);
+				this->scale.push_back(scale);
+				this->index.push_back((float)sceneIndex);
+			}
+
+			void pad() {
+				Affine far = Affine::identity();
+				far.m[3] = far.m[7] = far.m[11] = 1e18f;
+
+				while (this->index.size() % simd::WIDTH != 0) {
+					this->push(far, 1, UINT_MAX);
+				}
+			}
+
+			size_t size() const {
+				return this->index.size();
+			}
+
+			// Moves the query point into the local space of lanes [i, i + WIDTH),
+			// summed in the order of Affine::apply()
+			void toLocal(size_t i, simd::vfloat px, simd::vfloat py, simd::vfloat pz, simd::vfloat* x, simd::vfloat* y, simd::vfloat* z) const {
+				*x = simd::add(simd::add(simd::add(simd::mul(simd::load(&this->m[0][i]), px), simd::mul(simd::load(&this->m[1][i]), py)),
+					simd::mul(simd::load(&this->m[2][i]), pz)), simd::load(&this->m[3][i]));
+				*y = simd::add(simd::add(simd::add(simd::mul(simd::load(&this->m[4][i]), px), simd::mul(simd::load(&this->m[5][i]), py)),
+					simd::mul(simd::load(&this->m[6][i]), pz)), simd::load(&this->m[7][i]));
+				*z = simd::add(simd::add(simd::add(simd::mul(simd::load(&this->m[8][i]), px), simd::mul(simd::load(&this->m[9][i]), py)),
+					simd::mul(simd::load(&this->m[10][i]), pz)), simd::load(&this->m[11][i]));
+			}
+		};
+
+		Group spheres;
+		Group boxes;
+
+		std::vector<const Shape*> generic;
+		std::vector<unsigned int> genericIndices;
+
+		unsigned int shapeCount = 0;
+
+		// Folds the lanes of best/bestIndex into the running scalar result
+		static void reduce(simd::vfloat best, simd::vfloat bestIndex, float* smallest, unsigned int* outIndex) {
+			alignas(64) float distances[simd::WIDTH];
+			alignas(64) float indices[simd::WIDTH];
+
+			simd::store(distances, best);
+			simd::store(indices, bestIndex);
+
+			for (unsigned int i = 0; i < simd::WIDTH; i++) {
+				// Lanes that only saw ignored shapes or padding
+				if (indices[i] >= (float)UINT_MAX) continue;
+
+				unsigned int index = (unsigned int)indices[i];
+
+				// Ties go to the lower index, like a linear scan
+				if (distances[i] < *smallest || (distances[i] == *smallest && index < *outIndex)) {
+					*smallest = distances[i];
+					*outIndex = index;
+				}
+			}
+		}
+
+		void nearestSphere(const sf::Vector3f input, unsigned int ignoredIndex, float* smallest, unsigned int* outIndex) const {
+			if (this->spheres.size() == 0) return;
+
+			const simd::vfloat px = simd::set(input.x);
+			const simd::vfloat py = simd::set(input.y);
+			const simd::vfloat pz = simd::set(input.z);
+			const simd::vfloat ignored = simd::set((float)ignoredIndex);
+			const simd::vfloat infinity = simd::set(std::numeric_limits<float>::infinity());
+
+			simd::vfloat best = infinity;
+			simd::vfloat bestIndex = simd::set((float)UINT_MAX);
+
+			for (size_t i = 0; i < this->spheres.size(); i += simd::WIDTH) {
+				simd::vfloat x, y, z;
+				this->spheres.toLocal(i, px, py, pz, &x, &y, &z);
+
+				simd::vfloat distance = simd::mul(sphereDESimd(x, y, z), simd::load(&this->spheres.scale[i]));
+
+				simd::vfloat index = simd::load(&this->spheres.index[i]);
+				distance = simd::select(simd::equal(index, ignored), distance, infinity);
+
+				simd::vmask closer = simd::lessThan(distance, best);
+				best = simd::select(closer, best, distance);
+				bestIndex = simd::select(closer, bestIndex, index);
+			}
+
+			reduce(best, bestIndex, smallest, outIndex);
+		}
+
+		void nearestBox(const sf::Vector3f input, unsigned int ignoredIndex, float* smallest, unsigned int* outIndex) const {
+			if (this->boxes.size() == 0) return;
+
+			const simd::vfloat px = simd::set(input.x);
+			const simd::vfloat py = simd::set(input.y);
+			const simd::vfloat pz = simd::set(input.z);
+			const simd::vfloat ignored = simd::set((float)ignoredIndex);
+			const simd::vfloat infinity = simd::set(std::numeric_limits<float>::infinity());
+
+			simd::vfloat best = infinity;
+			simd::vfloat bestIndex = simd::set((float)UINT_MAX);
+
+			for (size_t i = 0; i < this->boxes.size(); i += simd::WIDTH) {
+				simd::vfloat x, y, z;
+				this->boxes.toLocal(i, px, py, pz, &x, &y, &z);
+
+				simd::vfloat distance = simd::mul(boxDESimd(x, y, z), simd::load(&this->boxes.scale[i]));
+
+				simd::vfloat index = simd::load(&this->boxes.index[i]);
+				distance = simd::select(simd::equal(index, ignored), distance, infinity);
+
+				simd::vmask closer = simd::lessThan(distance, best);
+				best = simd::select(closer, best, distance);
+				bestIndex = simd::select(closer, bestIndex, index);
+			}
+
+			reduce(best, bestIndex, smallest, outIndex);
+		}
+	};
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+namespace Manta {
+
+	// Level of detail of the scene queries of the calling thread. Rays
+	// set the footprint, the size a pixel covers at the point they query,
+	// and distance functions that iterate stop refining detail smaller
+	// than that. Shapes rescale it into the space their distance
+	// function is evaluated in. 0 asks for full detail.
+	class Detail {
+	public:
+		static float footprint() {
+			return local();
+		}
+
+		static void setFootprint(float footprint) {
+			local() = footprint;
+		}
+
+		// Multiplies the footprint by stretch for as long as it lives, for
+		// evaluating a space stretch times larger than the one outside
+		class Scope {
+		public:
+			explicit Scope(float stretch) {
+				this->saved = local();
+				local() = this->saved * stretch;
+			}
+
+			~Scope() {
+				local() = this->saved;
+			}
+
+			Scope(const Scope&) = delete;
+			Scope& operator=(const Scope&) = delete;
+
+		private:
+			float saved;
+		};
+
+	private:
+		static float& local() {
+			static thread_local float footprint = 0;
+			return footprint;
+		}
+	};
+}
@@ -0,0 +1,187 @@
+#pragma once
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include <SFML/Graphics.hpp>
+
+#include "Camera.hpp"
+#include "TileQueue.hpp"
+
+namespace Manta {
+
+	// Render handlers that present into a window, only the viewer links
+	// the SFML graphics and window modules they need
+
+	class DirectRenderHandler : public RenderHandler {
+	public:
+
+		// Uploads the tiles finished since the last call, never waits for
+		// the render workers
+		void update() {
+			for (auto& patch : this->finished.takeAll()) {
+				this->tex.update(patch->pixels.data(), patch->width, patch->height, patch->x, patch->y);
+			}
+
+			this->targetWindow->clear();
+			this->targetWindow->draw(sprite);
+			this->targetWindow->display();
+		}
+
+		void onFinish() override {
+
+		}
+
+		void onStart() override {
+
+		}
+
+		// Copies the finished rectangle out of the bitmap the workers own
+		void onTile(unsigned int x, unsigned int y, unsigned int width, unsigned int height) override {
+			TileQueue::Patch* patch = new TileQueue::Patch{ x, y, width, height };
+			patch->pixels.resize(width * height * 4);
+
+			for (unsigned int row = 0; row < height; row++) {
+				const sf::Uint8* source = &this->bitmap[(x + (y + row) * this->cameraData->dimensions.x) * 4];
+				std::copy(source, source + width * 4, &patch->pixels[row * width * 4]);
+			}
+
+			this->finished.push(patch);
+		}
+
+		DirectRenderHandler(CameraData* cameraData, sf::RenderWindow* targetWindow) : RenderHandler(cameraData) {
+			this->targetWindow = targetWindow;
+
+			this->tex = sf::Texture();
+
+			sf::Vector2u wSize = targetWindow->getSize();
+			this->tex.create(wSize.x, wSize.y);
+			this->sprite = sf::Sprite();
+			this->sprite.setTexture(this->tex);
+		}
+
+	private:
+		sf::Texture tex;
+		sf::Sprite sprite;
+		sf::RenderWindow* targetWindow;
+
+		TileQueue finished;
+	};
+
+	// Render workers composite every tile they finish into a patch of its
+	// own and queue it, update() takes the patches into the front buffer
+	// that only the window thread touches. The passes themselves are never
+	// read while a job runs.
+	class DirectMultipassRenderHandler : public MultipassRenderHandler {
+	public:
+
+		// Presents the tiles finished since the last call, never waits for
+		// the render workers. The cost view is scaled to the whole frame,
+		// so any new tile redoes it.
+		void update() {
+			std::vector<std::unique_ptr<TileQueue::Patch>> patches = this->finished.takeAll();
+			unsigned int width = this->cameraData->dimensions.x;
+
+			for (auto& patch : patches) {
+				for (unsigned int row = 0; row < patch->height; row++) {
+					unsigned int offset = patch->x + (patch->y + row) * width;
+					std::copy(&patch->pixels[row * patch->width * 4], &patch->pixels[(row + 1) * patch->width * 4], &this->front[offset * 4]);
+
+					if (patch->cost.empty()) continue;
+					std::copy(&patch->cost[row * patch->width * COST_CHANNELS], &patch->cost[(row + 1) * patch->width * COST_CHANNELS], &this->frontCost[offset * COST_CHANNELS]);
+				}
+			}
+
+			if (this->showingCost) {
+				if (!patches.empty() || this->viewChanged) {
+					heatmap(this->costChannel, this->frontCost.data(), this->heat.data(), width * this->cameraData->dimensions.y);
+					this->tex.update(this->heat.data());
+				}
+			}
+			else if (this->viewChanged) {
+				this->tex.update(this->front.data());
+			}
+			else {
+				for (auto& patch : patches) {
+					this->tex.update(patch->pixels.data(), patch->width, patch->height, patch->x, patch->y);
+				}
+			}
+			this->viewChanged = false;
+
+			this->targetWindow->clear();
+			this->targetWindow->draw(sprite);
+			this->targetWindow->display();
+		}
+
+		void onFinish() override {
+
+		}
+
+		void onStart() override {
+
+		}
+
+		void onTile(unsigned int x, unsigned int y, unsigned int width, unsigned int height) override {
+			TileQueue::Patch* patch = new TileQueue::Patch{ x, y, width, height };
+			patch->pixels.resize(width * height * 4);
+			this->compositeRect(x, y, x + width, y + height, patch->pixels.data(), width);
+
+			const PassBuffer* cost = this->getPass(Pass::Cost);
+			if (cost && RenderStats::isEnabled()) {
+				patch->cost.resize(width * height * COST_CHANNELS);
+				for (unsigned int row = 0; row < height; row++) {
+					cost->unpack(x + (y + row) * this->cameraData->dimensions.x, width, &patch->cost[row * width * COST_CHANNELS], COST_CHANNELS);
+				}
+			}
+
+			this->finished.push(patch);
+		}
+
+		void showComposite() {
+			this->showingCost = false;
+			this->viewChanged = true;
+		}
+
+		// Needs Pass::Cost and RenderStats enabled while rendering, the view
+		// stays black otherwise
+		void showCost(CostChannel channel) {
+			this->showingCost = true;
+			this->costChannel = channel;
+			this->viewChanged = true;
+		}
+
+		DirectMultipassRenderHandler(CameraData* cameraData, sf::RenderWindow* targetWindow, const PassRegistry& registry = PassRegistry::defaults()):
+			MultipassRenderHandler(cameraData, registry) {
+			this->targetWindow = targetWindow;
+
+			this->tex = sf::Texture();
+
+			sf::Vector2u wSize = targetWindow->getSize();
+			this->tex.create(wSize.x, wSize.y);
+			this->sprite = sf::Sprite();
+			this->sprite.setTexture(this->tex);
+
+			unsigned int count = cameraData->dimensions.x * cameraData->dimensions.y;
+			this->front.assign(count * 4, 0);
+			this->frontCost.assign(count * COST_CHANNELS, 0);
+			this->heat.assign(count * 4, 0);
+		}
+
+	private:
+		sf::Texture tex;
+		sf::Sprite sprite;
+		sf::RenderWindow* targetWindow;
+
+		bool showingCost = false;
+		bool viewChanged = false;
+		CostChannel costChannel = CostChannel::PrimarySteps;
+
+		TileQueue finished;
+
+		// Latest composite and cost of every pixel, window thread only
+		std::vector<sf::Uint8> front;
+		std::vector<float> frontCost;
+		std::vector<sf::Uint8> heat;
+	};
+}
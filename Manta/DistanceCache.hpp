@@ -0,0 +1,419 @@
+#pragma once
+
+#include <algorithm>
+#include <climits>
+#include <functional>
+#include <limits>
+#include <math.h>
+#include <vector>
+
+#include <SFML/System.hpp>
+
+#include "Bounds.hpp"
+#include "ThreadPool.hpp"
+
+namespace Manta {
+
+	struct DistanceCacheSettings {
+		bool enabled = false;
+
+		// Samples along the longest side of the scene bound
+		unsigned int resolution = 256;
+
+		// Bytes the sample grids of the bricks may take, the one value
+		// every brick keeps comes on top
+		size_t memoryBudget = (size_t)64 << 20;
+
+		bool operator==(const DistanceCacheSettings& other) const {
+			return this->enabled == other.enabled &&
+				this->resolution == other.resolution &&
+				this->memoryBudget == other.memoryBudget;
+		}
+	};
+
+	// Sparse brick map of scene distances for static scenes. The scene
+	// bound is cut into bricks of BRICK^3 cells, every brick stores the
+	// distance at its center and the bricks closest to a surface also a
+	// grid of SAMPLES^3 distances, as many as the memory budget allows.
+	// Lookups return a lower bound of the scene distance, only trustworthy
+	// far from surfaces, the scene evaluates exactly below nearDistance().
+	class DistanceCache {
+	public:
+		static const unsigned int BRICK = 8;
+		static const unsigned int SAMPLES = BRICK + 1;
+
+		// Scene distance at a point without the cache and the index of the
+		// closest shape
+		typedef std::function<float(sf::Vector3f, unsigned int*)> Evaluate;
+
+		// Returns false if the settings were already in use
+		bool configure(const DistanceCacheSettings& settings) {
+			if (settings == this->settings) return false;
+
+			this->settings = settings;
+			this->markAll();
+			return true;
+		}
+
+		const DistanceCacheSettings& getSettings() const {
+			return this->settings;
+		}
+
+		bool isReady() const {
+			return this->ready;
+		}
+
+		// Everything is rebuilt by the next update()
+		void markAll() {
+			this->rebuild = true;
+			this->pendingShapes.clear();
+		}
+
+		// Shape index was mounted or moved, the next update() rebuilds the
+		// bricks around its old and new bound
+		void markShape(unsigned int index) {
+			if (this->rebuild) return;
+
+			// Cheaper to start over than to test every brick against each
+			if (this->pendingShapes.size() >= MAX_PENDING) this->markAll();
+			else this->pendingShapes.push_back(index);
+		}
+
+		// Brings the cache up to date with the scene. shapeBounds holds the
+		// world bound of every shape, evaluate has to be thread safe.
+		void update(const Bounds& sceneBounds, const std::vector<Bounds>& shapeBounds, const Evaluate& evaluate, ThreadPool* pool) {
+			if (!this->settings.enabled || sceneBounds.isEmpty() || sceneBounds.isInfinite()) {
+				this->clear();
+				this->shapeBounds = shapeBounds;
+				this->rebuild = false;
+				this->pendingShapes.clear();
+				return;
+			}
+
+			if (!this->ready || !this->contains(sceneBounds)) this->rebuild = true;
+
+			// Can still ask for a full rebuild
+			if (!this->rebuild && !this->pendingShapes.empty()) this->refresh(shapeBounds, evaluate, pool);
+
+			if (this->rebuild) this->build(sceneBounds, evaluate, pool);
+
+			this->shapeBounds = shapeBounds;
+			this->rebuild = false;
+			this->pendingShapes.clear();
+		}
+
+		// Lower bound of the scene distance at point, -infinity outside the
+		// cached volume. outIndex gets the closest shape of the nearest
+		// sample, UINT_MAX outside.
+		float lookup(sf::Vector3f point, unsigned int* outIndex) const {
+			float gx = (point.x - this->origin.x) * this->inverseCellSize;
+			float gy = (point.y - this->origin.y) * this->inverseCellSize;
+			float gz = (point.z - this->origin.z) * this->inverseCellSize;
+
+			// Also rejects NaN
+			if (!(gx >= 0 && gy >= 0 && gz >= 0 && gx < this->cells.x && gy < this->cells.y && gz < this->cells.z)) {
+				*outIndex = UINT_MAX;
+				return -std::numeric_limits<float>::infinity();
+			}
+
+			unsigned int bx = (unsigned int)gx / BRICK;
+			unsigned int by = (unsigned int)gy / BRICK;
+			unsigned int bz = (unsigned int)gz / BRICK;
+
+			const Brick& brick = this->bricks[bx + (by + bz * this->brickCount.y) * this->brickCount.x];
+
+			// The center distance bounds the whole brick, the scene changes by
+			// at most the distance moved
+			float half = BRICK * .5f;
+			float cx = (gx - bx * BRICK - half) * this->cellSize;
+			float cy = (gy - by * BRICK - half) * this->cellSize;
+			float cz = (gz - bz * BRICK - half) * this->cellSize;
+
+			float bound = brick.distance - sqrtf(cx * cx + cy * cy + cz * cz);
+			*outIndex = brick.index;
+
+			if (brick.detail < 0) return bound;
+
+			float fx = gx - bx * BRICK;
+			float fy = gy - by * BRICK;
+			float fz = gz - bz * BRICK;
+
+			unsigned int ix = std::min((unsigned int)fx, BRICK - 1);
+			unsigned int iy = std::min((unsigned int)fy, BRICK - 1);
+			unsigned int iz = std::min((unsigned int)fz, BRICK - 1);
+
+			float u = fx - ix;
+			float v = fy - iy;
+			float w = fz - iz;
+
+			unsigned int first = (unsigned int)brick.detail + ix + (iy + iz * SAMPLES) * SAMPLES;
+			const float* s = &this->samples[first];
+
+			const unsigned int Y = SAMPLES;
+			const unsigned int Z = SAMPLES * SAMPLES;
+
+			float x00 = s[0] + (s[1] - s[0]) * u;
+			float x10 = s[Y] + (s[Y + 1] - s[Y]) * u;
+			float x01 = s[Z] + (s[Z + 1] - s[Z]) * u;
+			float x11 = s[Y + Z] + (s[Y + Z + 1] - s[Y + Z]) * u;
+
+			float y0 = x00 + (x10 - x00) * v;
+			float y1 = x01 + (x11 - x01) * v;
+
+			float detailed = y0 + (y1 - y0) * w - this->margin;
+
+			if (detailed > bound) {
+				bound = detailed;
+				*outIndex = this->indices[first + (u >= .5f) + (v >= .5f) * Y + (w >= .5f) * Z];
+			}
+
+			return bound;
+		}
+
+		// Below this lookups are too coarse to march with
+		float nearDistance() const {
+			return this->cellSize;
+		}
+
+		// Bytes held by the bricks and their sample grids
+		size_t memoryUsage() const {
+			return this->bricks.size() * sizeof(Brick) +
+				this->samples.size() * sizeof(float) +
+				this->indices.size() * sizeof(unsigned int);
+		}
+
+		// Bricks with a sample grid / all bricks
+		unsigned int detailedBricks() const {
+			return (unsigned int)(this->samples.size() / GRID);
+		}
+
+		unsigned int brickTotal() const {
+			return (unsigned int)this->bricks.size();
+		}
+
+	private:
+		static const unsigned int GRID = SAMPLES * SAMPLES * SAMPLES;
+		static const unsigned int MAX_PENDING = 64;
+
+		// Bricks handed to a worker at once
+		static const unsigned int BATCH = 64;
+
+		struct Brick {
+			float distance;
+			unsigned int index;
+
+			// First sample of the grid, -1 without one
+			int detail;
+		};
+
+		DistanceCacheSettings settings;
+
+		bool ready = false;
+		bool rebuild = true;
+		std::vector<unsigned int> pendingShapes;
+
+		// Shape bounds of the last update, the old position of moved shapes
+		std::vector<Bounds> shapeBounds;
+
+		sf::Vector3f origin;
+		float cellSize = 1;
+		float inverseCellSize = 1;
+
+		// Largest error of a trilinear lookup, sqrt(3) / 2 cells for a
+		// function that changes by at most 1 per unit
+		float margin = 0;
+
+		sf::Vector3<unsigned int> brickCount;
+		sf::Vector3f cells;
+
+		std::vector<Brick> bricks;
+		std::vector<float> samples;
+		std::vector<unsigned int> indices;
+
+		void clear() {
+			this->ready = false;
+			this->bricks.clear();
+			this->samples.clear();
+			this->indices.clear();
+		}
+
+		bool contains(const Bounds& bounds) const {
+			sf::Vector3f end = this->origin + this->cells * this->cellSize;
+
+			return bounds.min.x >= this->origin.x && bounds.min.y >= this->origin.y && bounds.min.z >= this->origin.z &&
+				bounds.max.x <= end.x && bounds.max.y <= end.y && bounds.max.z <= end.z;
+		}
+
+		Bounds brickBounds(unsigned int i) const {
+			unsigned int x = i % this->brickCount.x;
+			unsigned int y = i / this->brickCount.x % this->brickCount.y;
+			unsigned int z = i / this->brickCount.x / this->brickCount.y;
+
+			float size = BRICK * this->cellSize;
+			sf::Vector3f min = this->origin + sf::Vector3f(x * size, y * size, z * size);
+
+			return Bounds{ min, min + sf::Vector3f(size, size, size) };
+		}
+
+		// Half the diagonal of a brick
+		float brickRadius() const {
+			return BRICK * this->cellSize * sqrtf(3) * .5f;
+		}
+
+		// Sample capacity the memory budget allows for
+		size_t budgetBricks() const {
+			return this->settings.memoryBudget / (GRID * (sizeof(float) + sizeof(unsigned int)));
+		}
+
+		static void forEach(ThreadPool* pool, unsigned int count, const std::function<void(unsigned int)>& task) {
+			unsigned int batches = (count + BATCH - 1) / BATCH;
+
+			auto batch = [&](unsigned int b) {
+				unsigned int end = std::min(count, (b + 1) * BATCH);
+				for (unsigned int i = b * BATCH; i < end; i++) task(i);
+			};
+
+			if (pool) pool->parallelFor(batches, batch);
+			else for (unsigned int b = 0; b < batches; b++) batch(b);
+		}
+
+		void build(const Bounds& sceneBounds, const Evaluate& evaluate, ThreadPool* pool) {
+			sf::Vector3f size = sceneBounds.size();
+			float longest = std::max(size.x, std::max(size.y, size.z));
+
+			this->cellSize = std::max(longest, 1e-3f) / std::max(this->settings.resolution, 1u);
+			this->inverseCellSize = 1 / this->cellSize;
+			this->margin = this->cellSize * sqrtf(3) * .5f;
+
+			// Half a brick of room on every side, rays start a little outside
+			float brickSize = BRICK * this->cellSize;
+			this->origin = sceneBounds.min - sf::Vector3f(brickSize, brickSize, brickSize) * .5f;
+
+			this->brickCount = sf::Vector3<unsigned int>(
+				(unsigned int)ceilf(size.x / brickSize) + 1,
+				(unsigned int)ceilf(size.y / brickSize) + 1,
+				(unsigned int)ceilf(size.z / brickSize) + 1
+			);
+			this->cells = sf::Vector3f(
+				(float)(this->brickCount.x * BRICK),
+				(float)(this->brickCount.y * BRICK),
+				(float)(this->brickCount.z * BRICK)
+			);
+
+			this->bricks.assign((size_t)this->brickCount.x * this->brickCount.y * this->brickCount.z, Brick{ 0, 0, -1 });
+			this->samples.clear();
+			this->indices.clear();
+
+			unsigned int count = (unsigned int)this->bricks.size();
+			forEach(pool, count, [&](unsigned int i) { this->evaluateCenter(i, evaluate); });
+
+			// Sample grids go to the bricks closest to a surface, skipping
+			// those so close that every lookup in them would be exact anyway
+			std::vector<unsigned int> candidates;
+			for (unsigned int i = 0; i < count; i++) {
+				if (this->wantsDetail(this->bricks[i])) candidates.push_back(i);
+			}
+
+			size_t capacity = std::min(candidates.size(), this->budgetBricks());
+			std::partial_sort(candidates.begin(), candidates.begin() + capacity, candidates.end(), [this](unsigned int a, unsigned int b) {
+				return this->bricks[a].distance < this->bricks[b].distance;
+			});
+			candidates.resize(capacity);
+
+			for (unsigned int i : candidates) this->allocateDetail(i);
+
+			forEach(pool, (unsigned int)candidates.size(), [&](unsigned int c) { this->evaluateDetail(candidates[c], evaluate); });
+
+			this->ready = true;
+		}
+
+		// Rebuilds the bricks a shape of pendingShapes can have changed.
+		// A brick can only change where the old or new bound of the shape
+		// comes closer than the farthest distance stored in it.
+		void refresh(const std::vector<Bounds>& currentBounds, const Evaluate& evaluate, ThreadPool* pool) {
+			std::vector<Bounds> regions;
+			for (unsigned int index : this->pendingShapes) {
+				if (index < this->shapeBounds.size()) regions.push_back(this->shapeBounds[index]);
+				if (index < currentBounds.size()) regions.push_back(currentBounds[index]);
+			}
+
+			for (const Bounds& region : regions) {
+				if (region.isInfinite()) {
+					this->rebuild = true;
+					return;
+				}
+			}
+
+			float radius = this->brickRadius();
+
+			std::vector<unsigned int> dirty;
+			for (unsigned int i = 0; i < this->bricks.size(); i++) {
+				Bounds brick = this->brickBounds(i);
+				float farthest = this->bricks[i].distance + radius;
+
+				for (const Bounds& region : regions) {
+					if (distanceBetween(brick, region) <= farthest) {
+						dirty.push_back(i);
+						break;
+					}
+				}
+			}
+
+			forEach(pool, (unsigned int)dirty.size(), [&](unsigned int d) { this->evaluateCenter(dirty[d], evaluate); });
+
+			// Keep the grids that exist, hand out what the budget has left
+			size_t available = this->budgetBricks() - std::min(this->budgetBricks(), (size_t)this->detailedBricks());
+			std::vector<unsigned int> detailed;
+
+			for (unsigned int i : dirty) {
+				if (this->bricks[i].detail < 0 && available > 0 && this->wantsDetail(this->bricks[i])) {
+					this->allocateDetail(i);
+					available--;
+				}
+				if (this->bricks[i].detail >= 0) detailed.push_back(i);
+			}
+
+			forEach(pool, (unsigned int)detailed.size(), [&](unsigned int d) { this->evaluateDetail(detailed[d], evaluate); });
+		}
+
+		bool wantsDetail(const Brick& brick) const {
+			return brick.distance + this->brickRadius() >= this->nearDistance();
+		}
+
+		void allocateDetail(unsigned int i) {
+			this->bricks[i].detail = (int)this->samples.size();
+			this->samples.resize(this->samples.size() + GRID);
+			this->indices.resize(this->indices.size() + GRID);
+		}
+
+		void evaluateCenter(unsigned int i, const Evaluate& evaluate) {
+			Brick& brick = this->bricks[i];
+			brick.distance = evaluate(this->brickBounds(i).center(), &brick.index);
+		}
+
+		void evaluateDetail(unsigned int i, const Evaluate& evaluate) {
+			sf::Vector3f min = this->brickBounds(i).min;
+			unsigned int first = (unsigned int)this->bricks[i].detail;
+
+			for (unsigned int z = 0; z < SAMPLES; z++) {
+				for (unsigned int y = 0; y < SAMPLES; y++) {
+					for (unsigned int x = 0; x < SAMPLES; x++) {
+						unsigned int sample = first + x + (y + z * SAMPLES) * SAMPLES;
+						sf::Vector3f point = min + sf::Vector3f((float)x, (float)y, (float)z) * this->cellSize;
+
+						this->samples[sample] = evaluate(point, &this->indices[sample]);
+					}
+				}
+			}
+		}
+
+		// Smallest distance between two boxes, 0 if they overlap
+		static float distanceBetween(const Bounds& a, const Bounds& b) {
+			float dx = std::max(0.f, std::max(a.min.x - b.max.x, b.min.x - a.max.x));
+			float dy = std::max(0.f, std::max(a.min.y - b.max.y, b.min.y - a.max.y));
+			float dz = std::max(0.f, std::max(a.min.z - b.max.z, b.min.z - a.max.z));
+
+			return sqrtf(dx * dx + dy * dy + dz * dz);
+		}
+	};
+}
@@ -0,0 +1,185 @@
+#pragma once
+
+#include <math.h>
+
+#include <SFML/System.hpp>
+
+#include "Shape.hpp"
+#include "Detail.hpp"
+
+namespace Manta {
+
+	// Iterations and escape radius an iterated fractal needs at the
+	// current Detail footprint. Its detail starts at size and shrinks by
+	// growth with every iteration, so iterations past the first one
+	// below the footprint can't be seen. The escape radius follows the
+	// iterations down from fullEscape to minEscape, orbits leave sooner
+	// where the estimate only has to be good to a pixel.
+	struct FractalDetail {
+		unsigned int iterations;
+		float escape;
+	};
+
+	inline FractalDetail fractalDetail(
+		float size,
+		float growth,
+		unsigned int minIterations,
+		unsigned int maxIterations,
+		float minEscape,
+		float fullEscape
+	) {
+		float footprint = Detail::footprint();
+		if (!(footprint > 0)) return FractalDetail{ maxIterations, fullEscape };
+
+		float levels = ceilf(logf(size / footprint) / logf(growth)) + 1;
+		unsigned int iterations = (unsigned int)fminf(fmaxf(levels, (float)minIterations), (float)maxIterations);
+
+		float share = (float)(iterations - minIterations) / (maxIterations - minIterations);
+		return FractalDetail{ iterations, minEscape + (fullEscape - minEscape) * share };
+	}
+
+	// Mandelbulb
+	// Power 8 in spherical coordinates, fits in a sphere of radius 1.2
+	inline float mandelbulbDE(sf::Vector3f point) {
+		float radius = sqrtf(point.x * point.x + point.y * point.y + point.z * point.z);
+
+		// The estimate below overshoots far away, the bounding sphere doesn't
+		if (radius > 1.5f) return radius - 1.2f;
+
+		FractalDetail detail = fractalDetail(1, 4, 3, 12, 2, 8);
+
+		sf::Vector3f z = point;
+		float derivative = 1;
+		float r = radius;
+
+		for (unsigned int i = 0; i < detail.iterations; i++) {
+			r = sqrtf(z.x * z.x + z.y * z.y + z.z * z.z);
+			if (r > detail.escape) break;
+
+			float theta = acosf(r > 0 ? z.z / r : 1) * 8;
+			float phi = atan2f(z.y, z.x) * 8;
+
+			float r2 = r * r;
+			float r4 = r2 * r2;
+			float r7 = r4 * r2 * r;
+			derivative = 8 * r7 * derivative + 1;
+
+			float zr = r7 * r;
+			z = sf::Vector3f(
+				sinf(theta) * cosf(phi),
+				sinf(phi) * sinf(theta),
+				cosf(theta)
+			) * zr + point;
+		}
+
+		r = sqrtf(z.x * z.x + z.y * z.y + z.z * z.z);
+		return .5f * logf(r) * r / derivative;
+	}
+
+	Shape* Mandelbulb() {
+		Shape* s = new Shape();
+		s->distanceFunction = mandelbulbDE;
+		s->localBounds = Bounds::cube(1.2f);
+		return s;
+	}
+
+	// Menger sponge
+	// Cut out of the unit box, every iteration removes the middle thirds
+	inline float mengerDE(sf::Vector3f point) {
+		FractalDetail detail = fractalDetail(2.f / 3, 3, 1, 6, 0, 0);
+
+		float distance = boxDE(point);
+		float scale = 1;
+
+		for (unsigned int i = 0; i < detail.iterations; i++) {
+			// Position in the cell of this level, from -1 to 1
+			sf::Vector3f cell = point * scale * .5f;
+			cell = sf::Vector3f(
+				(cell.x - floorf(cell.x)) * 2 - 1,
+				(cell.y - floorf(cell.y)) * 2 - 1,
+				(cell.z - floorf(cell.z)) * 2 - 1
+			);
+			scale *= 3;
+
+			sf::Vector3f r(
+				fabsf(1 - 3 * fabsf(cell.x)),
+				fabsf(1 - 3 * fabsf(cell.y)),
+				fabsf(1 - 3 * fabsf(cell.z))
+			);
+
+			// Distance to the cross through the cell that gets removed
+			float cross = (std::min(std::max(r.x, r.y), std::min(std::max(r.y, r.z), std::max(r.z, r.x))) - 1) / scale;
+			distance = std::max(distance, cross);
+		}
+
+		return distance;
+	}
+
+	Shape* MengerSponge() {
+		Shape* s = new Shape();
+		s->distanceFunction = mengerDE;
+		s->localBounds = Bounds::cube(1);
+		return s;
+	}
+
+	// Mandelbox
+	// Scale 2 with the usual fold radii, shrunk by 6 to fill the unit box
+	inline float mandelboxDE(sf::Vector3f point) {
+		const float SCALE = 2;
+		const float EXTENT = 6;
+		const float MIN_RADIUS2 = .25f;
+		const float FIXED_RADIUS2 = 1;
+
+		FractalDetail detail = fractalDetail(4, 2, 3, 14, 16, 64);
+
+		sf::Vector3f offset = point * EXTENT;
+		sf::Vector3f z = offset;
+		float derivative = 1;
+		bool escaped = false;
+
+		for (unsigned int i = 0; i < detail.iterations; i++) {
+			// Box fold
+			z = sf::Vector3f(
+				std::min(std::max(z.x, -1.f), 1.f) * 2 - z.x,
+				std::min(std::max(z.y, -1.f), 1.f) * 2 - z.y,
+				std::min(std::max(z.z, -1.f), 1.f) * 2 - z.z
+			);
+
+			// Sphere fold
+			float r2 = z.x * z.x + z.y * z.y + z.z * z.z;
+			if (r2 < MIN_RADIUS2) {
+				z *= FIXED_RADIUS2 / MIN_RADIUS2;
+				derivative *= FIXED_RADIUS2 / MIN_RADIUS2;
+			}
+			else if (r2 < FIXED_RADIUS2) {
+				z *= FIXED_RADIUS2 / r2;
+				derivative *= FIXED_RADIUS2 / r2;
+			}
+
+			z = z * SCALE + offset;
+			derivative = derivative * SCALE + 1;
+
+			if (z.x * z.x + z.y * z.y + z.z * z.z > detail.escape * detail.escape) {
+				escaped = true;
+				break;
+			}
+		}
+
+		float estimate = sqrtf(z.x * z.x + z.y * z.y + z.z * z.z) / derivative / EXTENT;
+
+		// Orbits still inside after fewer iterations than full detail only
+		// shrink to the size of the footprint, so rays would creep along
+		// them forever. They count as inside the detail they skipped.
+		if (!escaped) estimate -= Detail::footprint();
+
+		// Far away the orbit estimate is loose, the box is a closer bound
+		return std::max(estimate, boxDE(point));
+	}
+
+	Shape* Mandelbox() {
+		Shape* s = new Shape();
+		s->distanceFunction = mandelboxDE;
+		s->localBounds = Bounds::cube(1);
+		return s;
+	}
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <SFML/System.hpp>
+
+#include "Camera.hpp"
+#include "ImageFile.hpp"
+
+namespace Manta {
+
+	// Keeps every pass in memory and composites once the frame is done,
+	// so it runs without a window or GPU, e.g. on render farm nodes
+	class HeadlessRenderHandler : public MultipassRenderHandler {
+	public:
+
+		void onFinish() override {
+			this->composite();
+		}
+
+		void onStart() override {
+
+		}
+
+		// Writes <prefix>.ppm with the composite and one file per requested
+		// pass: _albedo.ppm and _<name>.pfm for the others, see Pass for
+		// their units. Light may exceed 1, depth is infinity where the ray
+		// escaped.
+		bool writePasses(const std::string& prefix) {
+			unsigned int width = this->cameraData->dimensions.x;
+			unsigned int height = this->cameraData->dimensions.y;
+			unsigned int count = width * height;
+
+			bool ok = writePPM(prefix + ".ppm", this->bitmap, width, height);
+
+			for (unsigned int i = 0; i < (unsigned int)Pass::Count; i++) {
+				const PassBuffer* buffer = this->getPass((Pass)i);
+				if (!buffer) continue;
+
+				unsigned int channels = buffer->getChannels();
+				std::vector<float> pass(count * channels);
+				buffer->unpack(0, count, pass.data(), channels);
+
+				if ((Pass)i == Pass::Albedo) {
+					std::vector<sf::Uint8> rgba(count * 4, 255);
+					for (unsigned int p = 0; p < count; p++) {
+						for (unsigned int c = 0; c < 3; c++) rgba[p * 4 + c] = (sf::Uint8)(std::min(std::max(pass[p * 3 + c], 0.f), 1.f) * 255 + .5f);
+					}
+					ok = writePPM(prefix + "_albedo.ppm", rgba.data(), width, height) && ok;
+				}
+				else {
+					ok = writePFM(prefix + "_" + PassRegistry::name((Pass)i) + ".pfm", pass.data(), width, height, channels) && ok;
+				}
+			}
+
+			return ok;
+		}
+
+		HeadlessRenderHandler(CameraData* cameraData, const PassRegistry& registry = PassRegistry::defaults()) :
+			MultipassRenderHandler(cameraData, registry) {
+		}
+	};
+}
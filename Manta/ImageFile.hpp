@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <SFML/System.hpp>
+
+namespace Manta {
+
+	// Binary PPM (P6) from an RGBA bitmap, alpha gets dropped
+	inline bool writePPM(const std::string& path, const sf::Uint8* rgba, unsigned int width, unsigned int height) {
+		FILE* file = fopen(path.c_str(), "wb");
+		if (!file) return false;
+
+		fprintf(file, "P6\n%u %u\n255\n", width, height);
+
+		std::vector<sf::Uint8> row(width * 3);
+		bool ok = true;
+
+		for (unsigned int y = 0; y < height && ok; y++) {
+			for (unsigned int x = 0; x < width; x++) {
+				const sf::Uint8* pixel = &rgba[(x + y * width) * 4];
+				row[x * 3] = pixel[0];
+				row[x * 3 + 1] = pixel[1];
+				row[x * 3 + 2] = pixel[2];
+			}
+			ok = fwrite(row.data(), 1, row.size(), file) == row.size();
+		}
+
+		return fclose(file) == 0 && ok;
+	}
+
+	// PFM with 1 (Pf) or 3 (PF) interleaved channels. The format stores
+	// rows bottom to top, the negative scale marks little endian floats.
+	inline bool writePFM(const std::string& path, const float* data, unsigned int width, unsigned int height, unsigned int channels) {
+		FILE* file = fopen(path.c_str(), "wb");
+		if (!file) return false;
+
+		fprintf(file, "%s\n%u %u\n-1.0\n", channels == 1 ? "Pf" : "PF", width, height);
+
+		size_t rowSize = (size_t)width * channels;
+		bool ok = true;
+
+		for (unsigned int y = height; y-- > 0 && ok;) {
+			ok = fwrite(&data[y * rowSize], sizeof(float), rowSize, file) == rowSize;
+		}
+
+		return fclose(file) == 0 && ok;
+	}
+}
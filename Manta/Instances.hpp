@@ -0,0 +1,130 @@
+#pragma once
+
+#include <climits>
+#include <limits>
+#include <memory>
+#include <vector>
+
+#include <SFML/System.hpp>
+
+#include "Affine.hpp"
+#include "Bounds.hpp"
+#include "BVH.hpp"
+#include "Shape.hpp"
+#include "Transform.hpp"
+#include "RenderStats.hpp"
+
+namespace Manta {
+
+	// One prototype shape placed many times. Instances are nothing but a
+	// matrix and a scale stored next to each other, and a BVH over their
+	// bounds finds the few near a point, so a query evaluates the
+	// prototype a handful of times however many instances there are.
+	class Instances : public DistanceField {
+	public:
+
+		// Takes ownership of prototype, whose transforms are applied after
+		// the placement of every instance
+		explicit Instances(Shape* prototype) {
+			prototype->bake();
+			this->prototype = *prototype;
+			delete prototype;
+		}
+
+		// Same placement as placeShape(), rotated by eulerAngles in
+		// between like a Rotate transform
+		void add(sf::Vector3f center, sf::Vector3f size, sf::Vector3f eulerAngles = sf::Vector3f()) {
+			Translate translate(-center);
+
+			Rotate rotate;
+			rotate.eulerAngles = eulerAngles;
+
+			Scale scale;
+			scale.factor = size;
+
+			Transform* placement[] = { &translate, &rotate, &scale };
+
+			Affine combined = Affine::identity();
+			for (Transform* transform : placement) {
+				Affine next;
+				transform->toAffine(&next);
+				combined = combined.then(next);
+			}
+
+			Bounds bounds = this->prototype.getBounds();
+			for (size_t i = 3; i > 0; i--) bounds = placement[i - 1]->transformBounds(bounds);
+
+			this->instances.push_back(Instance{ combined, 1 / combined.maxStretch() });
+			this->instanceBounds.push_back(bounds);
+		}
+
+		// Has to be called after the last add(), Instanced() does
+		void build() {
+			std::vector<unsigned int> items;
+			items.reserve(this->instances.size());
+
+			this->bounds = Bounds::empty();
+			for (unsigned int i = 0; i < this->instances.size(); i++) {
+				this->bounds.extend(this->instanceBounds[i]);
+				items.push_back(i);
+			}
+
+			this->bvh.build(this->instanceBounds, items);
+		}
+
+		// Bound of all instances, valid after build()
+		Bounds getBounds() const {
+			return this->bounds;
+		}
+
+		unsigned int getInstanceCount() const {
+			return (unsigned int)this->instances.size();
+		}
+
+		// Prototype evaluations are added to the distance estimates of
+		// RenderStats, on top of the one the scene counts for the shape
+		float distance(sf::Vector3f point, float cutoff) const override {
+			unsigned int closest = UINT_MAX;
+			unsigned int evaluations = 0;
+
+			// Nothing closer than cutoff means every instance is at least
+			// that far away, so cutoff is a valid answer
+			float distance = this->bvh.nearest(point, cutoff, &closest, [&](unsigned int i, float best) {
+				const Instance& instance = this->instances[i];
+
+				evaluations++;
+				return this->prototype.distanceEstimate(instance.transform.apply(point), best / instance.scale) * instance.scale;
+			});
+
+			if (RenderStats::isEnabled()) RenderStats::local().distanceEstimates += evaluations;
+
+			return distance;
+		}
+
+	private:
+		// Baked placement like Shape::bake() produces it
+		struct Instance {
+			Affine transform;
+			float scale;
+		};
+
+		Shape prototype;
+
+		std::vector<Instance> instances;
+		std::vector<Bounds> instanceBounds;
+
+		Bounds bounds = Bounds::empty();
+		BVH bvh;
+	};
+
+	// Shape evaluating instances, which it takes ownership of. Instances
+	// added later aren't covered.
+	Shape* Instanced(Instances* instances) {
+		instances->build();
+
+		Shape* s = new Shape();
+		s->field = std::shared_ptr<const DistanceField>(instances);
+		s->localBounds = instances->getBounds();
+		return s;
+	}
+}
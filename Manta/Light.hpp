@@ -1,26 +1,27 @@
 #pragma once
 
-#include <SFML/Graphics.hpp>;
+#include <SFML/System.hpp>;
+#include "Color.hpp"
 
 namespace Manta {
 
 
-	class Light abstract {
+	class Light {
 	public:
-		sf::Color getColor() {
+		Color getColor() const {
 			return this->color;
 		}
 
-		float getIntensity() {
+		float getIntensity() const {
 			return this->intensity;
 		}
 
 	protected:
-		sf::Color color;
+		Color color;
 		float intensity;
 
 		Light() {
-			this->color = sf::Color(255, 255, 255);
+			this->color = Color(255, 255, 255);
 			this->intensity = 1;
 		}
 	};
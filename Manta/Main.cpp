@@ -6,6 +6,9 @@
 #include "Transform.hpp";
 #include "Scene.hpp";
 #include "Camera.hpp";
+#include "DirectRenderHandler.hpp"
+#include "Scenes.hpp"
+#include "RenderStats.hpp"
 
 int main() {
 	sf::RenderWindow _window;
@@ -16,36 +19,34 @@ int main() {
 	sf::Event _windowEvent;
 
 	auto scene = Manta::Scene();
-	scene.setSkyColor(sf::Color(70, 90, 240));
+	scene.setAcceleration(Manta::Acceleration::BVH);
 	
 	auto cameraData = Manta::CameraData();
 	cameraData.targetScene = &scene;
 	cameraData.dimensions = sf::Vector2u(1280, 720);
 	cameraData.position = sf::Vector3f(-50, 0, 0);
+	cameraData.progressive = true;
 
-	auto renderHandler = Manta::DirectMultipassRenderHandler(&cameraData, &_window);
+	// Moving the camera only marches what the previous frame didn't show
+	cameraData.reprojection = true;
 
-	auto camera = Manta::PBRCamera(&cameraData, &renderHandler, 16);
+	// Half resolution ambient occlusion darkens creases and contacts
+	cameraData.aoSamples = 5;
+	cameraData.aoHalfResolution = true;
 
-	// GENERATE TEST SCENE
-	const unsigned int NUM_ENTITIES = 20;
-	
-	for (unsigned int i = 0; i < NUM_ENTITIES; i++) {
-		
-		auto sphere = (std::rand() % 2) == 0 || true ? Manta::Sphere() : Manta::Box();
-
-		sphere->color = sf::Color(std::rand() % 255, std::rand() % 255, std::rand() % 255);
+	// Reprojection warps the hit positions, the cost views show the cost pass
+	Manta::PassRegistry passes = Manta::PassRegistry::defaults();
+	passes.request(Manta::Pass::Position, Manta::PassFormat::Float);
+	passes.request(Manta::Pass::Cost, Manta::PassFormat::Float);
+	passes.request(Manta::Pass::AO, Manta::PassFormat::U8);
 
-		auto transform = new Manta::Translate(sf::Vector3f(
-			std::rand() % 10 - 5,
-			std::rand() % 20 - 10,
-			std::rand() % 20 - 10
-		));
+	auto renderHandler = Manta::DirectMultipassRenderHandler(&cameraData, &_window, passes);
+	renderHandler.setCompositeBlend(0, Manta::Color(), .8f);
 
-		sphere->pushTransform(transform);
+	auto camera = Manta::PBRCamera(&cameraData, &renderHandler);
 
-		scene.mountShape(sphere);
-	}	
+	// Seeded, so every run shows the same scene
+	Manta::demoScene(&scene);
 
 
 	camera.render();
@@ -58,6 +59,60 @@ int main() {
 			if (_windowEvent.type == sf::Event::Closed) {
 				_window.close();
 			}
+
+			// Move the camera, render() cancels the frame still in flight
+			if (_windowEvent.type == sf::Event::KeyPressed) {
+				sf::Vector3f move;
+				switch (_windowEvent.key.code) {
+				case sf::Keyboard::W: move.x = 1; break;
+				case sf::Keyboard::S: move.x = -1; break;
+				case sf::Keyboard::A: move.z = -1; break;
+				case sf::Keyboard::D: move.z = 1; break;
+				case sf::Keyboard::Q: move.y = -1; break;
+				case sf::Keyboard::E: move.y = 1; break;
+				default: break;
+				}
+
+				if (move != sf::Vector3f()) {
+					cameraData.position += move;
+					Manta::RenderStats::reset();
+					camera.render();
+				}
+
+				// 1 shows the composite, 2 - 4 the cost of every pixel as
+				// primary steps, shadow steps and distance estimates. The
+				// cost views need RenderStats, so switching re-renders.
+				bool costView = true;
+				switch (_windowEvent.key.code) {
+				case sf::Keyboard::Num1: renderHandler.showComposite(); costView = false; break;
+				case sf::Keyboard::Num2: renderHandler.showCost(Manta::CostChannel::PrimarySteps); break;
+				case sf::Keyboard::Num3: renderHandler.showCost(Manta::CostChannel::ShadowSteps); break;
+				case sf::Keyboard::Num4: renderHandler.showCost(Manta::CostChannel::DistanceEstimates); break;
+				default: costView = Manta::RenderStats::isEnabled(); break;
+				}
+
+				if (costView != Manta::RenderStats::isEnabled()) {
+					Manta::RenderStats::setEnabled(costView);
+					Manta::RenderStats::reset();
+					camera.render();
+				}
+
+				// M drops a sphere in front of the camera. The frame in
+				// flight keeps rendering its own snapshot until render()
+				// starts one of the edited scene.
+				if (_windowEvent.key.code == sf::Keyboard::M) {
+					Manta::Shape* sphere = Manta::Sphere();
+					sphere->color = Manta::Color(240, 200, 60);
+					sphere->pushTransform(new Manta::Translate(-(cameraData.position + sf::Vector3f(20, 0, 0))));
+					scene.mountShape(sphere);
+					camera.render();
+				}
+
+				// Counters of the renders since the last reset
+				if (_windowEvent.key.code == sf::Keyboard::P) {
+					Manta::RenderStats::totals().dump(std::cout);
+				}
+			}
 		}
 	}
 
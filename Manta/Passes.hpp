@@ -0,0 +1,299 @@
+#pragma once
+
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+namespace Manta {
+
+	// Per pixel outputs (AOVs) a MultipassRenderHandler can keep
+	enum class Pass {
+		// RGB surface colour, 1 is full
+		Albedo,
+
+		// RGB light reaching the surface, 1 is full intensity and it may
+		// exceed that
+		Light,
+
+		// Distance / maxDistance, 1 where the ray escaped
+		Mist,
+
+		// Fraction of the surroundings not occluded, 1 is open
+		AO,
+
+		// Distance along the primary ray, infinity where it escaped
+		Depth,
+
+		// XYZ world space position of the hit
+		Position,
+
+		// XYZ world space unit normal of the hit surface, 0 where the ray
+		// escaped. Components are signed, so Half or Float.
+		Normal,
+
+		// Primary steps, shadow steps and distance estimates, see
+		// CostChannel. Only written while RenderStats is enabled.
+		Cost,
+
+		Count
+	};
+
+	enum class PassFormat {
+		// Colour like passes keep [0, 1] scaled to 255, the others whole
+		// numbers up to 255
+		U8,
+
+		// IEEE 754 binary16, about 3 significant digits
+		Half,
+
+		Float
+	};
+
+	inline uint16_t floatToHalf(float value) {
+		uint32_t bits;
+		memcpy(&bits, &value, 4);
+
+		uint16_t sign = (uint16_t)((bits >> 16) & 0x8000);
+		uint32_t magnitude = bits & 0x7fffffff;
+
+		// Infinity and NaN
+		if (magnitude >= 0x7f800000) return sign | 0x7c00 | (magnitude > 0x7f800000 ? 0x200 : 0);
+
+		// Rounds to infinity above 65504
+		if (magnitude >= 0x477ff000) return sign | 0x7c00;
+
+		// Below the smallest normal half, in steps of 2^-24
+		if (magnitude < 0x38800000) {
+			float absolute;
+			memcpy(&absolute, &magnitude, 4);
+			return sign | (uint16_t)lrintf(absolute * 16777216.f);
+		}
+
+		// Rebias the exponent from 127 to 15, round to nearest even
+		uint32_t half = (magnitude - 0x38000000) >> 13;
+		uint32_t rest = magnitude & 0x1fff;
+		if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) half++;
+
+		return sign | (uint16_t)half;
+	}
+
+	inline float halfToFloat(uint16_t half) {
+		// Shifted into place the bits read as a float 2^112 times too small,
+		// which also holds for subnormal halves, so one multiply rebiases.
+		// No branches, so loops over many of them vectorize.
+		uint32_t bits = (uint32_t)(half & 0x7fff) << 13;
+
+		float value;
+		memcpy(&value, &bits, 4);
+		value *= 5.192296858534828e33f;
+		memcpy(&bits, &value, 4);
+
+		// Infinity and NaN keep their maximum exponent
+		bits |= (value >= 65536.f ? 0x7f800000u : 0u) | (uint32_t)(half & 0x8000) << 16;
+
+		memcpy(&value, &bits, 4);
+		return value;
+	}
+
+	// Which passes a render needs and the format of each. Only these get
+	// allocated by a MultipassRenderHandler and written by the camera.
+	class PassRegistry {
+	public:
+
+		// Albedo, light and mist as before, plus the depth reprojection
+		// needs. Position (also needed by reprojection), AO and Cost have
+		// to be asked for.
+		static PassRegistry defaults() {
+			PassRegistry registry;
+			registry.request(Pass::Albedo, PassFormat::U8);
+			registry.request(Pass::Light, PassFormat::Half);
+			registry.request(Pass::Mist, PassFormat::U8);
+			registry.request(Pass::Depth, PassFormat::Float);
+			return registry;
+		}
+
+		PassRegistry& request(Pass pass, PassFormat format) {
+			this->requested[(unsigned int)pass] = true;
+			this->formats[(unsigned int)pass] = format;
+			return *this;
+		}
+
+		PassRegistry& drop(Pass pass) {
+			this->requested[(unsigned int)pass] = false;
+			return *this;
+		}
+
+		bool has(Pass pass) const {
+			return this->requested[(unsigned int)pass];
+		}
+
+		PassFormat format(Pass pass) const {
+			return this->formats[(unsigned int)pass];
+		}
+
+		static unsigned int channels(Pass pass) {
+			switch (pass) {
+			case Pass::Albedo: return 3;
+			case Pass::Light: return 3;
+			case Pass::Position: return 3;
+			case Pass::Normal: return 3;
+			case Pass::Cost: return 3;
+			default: return 1;
+			}
+		}
+
+		// What one in a U8 pass stands for
+		static float byteScale(Pass pass) {
+			switch (pass) {
+			case Pass::Albedo:
+			case Pass::Light:
+			case Pass::Mist:
+			case Pass::AO:
+				return 255;
+			default:
+				return 1;
+			}
+		}
+
+		// Lower case, as used for file names and on the command line
+		static const char* name(Pass pass) {
+			static const char* NAMES[(unsigned int)Pass::Count] = {
+				"albedo", "light", "mist", "ao", "depth", "position", "normal", "cost"
+			};
+			return NAMES[(unsigned int)pass];
+		}
+
+	private:
+		bool requested[(unsigned int)Pass::Count] = {};
+		PassFormat formats[(unsigned int)Pass::Count] = {};
+	};
+
+	// Storage of one pass, channels values per pixel in one format. Values
+	// go in and come out as floats in the units of the pass.
+	class PassBuffer {
+	public:
+
+		PassBuffer(unsigned int count, unsigned int channels, PassFormat format, float byteScale) {
+			this->channels = channels;
+			this->format = format;
+			this->scale = byteScale;
+
+			switch (format) {
+			case PassFormat::U8: this->bytes.assign((size_t)count * channels, 0); break;
+			case PassFormat::Half: this->halves.assign((size_t)count * channels, 0); break;
+			case PassFormat::Float: this->floats.assign((size_t)count * channels, 0); break;
+			}
+		}
+
+		void set(unsigned int pixel, unsigned int channel, float value) {
+			size_t i = (size_t)pixel * this->channels + channel;
+
+			switch (this->format) {
+			case PassFormat::U8: this->bytes[i] = (uint8_t)std::min(std::max(value * this->scale + .5f, 0.f), 255.f); break;
+			case PassFormat::Half: this->halves[i] = floatToHalf(value); break;
+			case PassFormat::Float: this->floats[i] = value; break;
+			}
+		}
+
+		float get(unsigned int pixel, unsigned int channel) const {
+			size_t i = (size_t)pixel * this->channels + channel;
+
+			switch (this->format) {
+			case PassFormat::U8: return this->bytes[i] / this->scale;
+			case PassFormat::Half: return halfToFloat(this->halves[i]);
+			default: return this->floats[i];
+			}
+		}
+
+		// Copies every channel of pixel from of source, which has to have
+		// the same layout
+		void copy(unsigned int to, const PassBuffer& source, unsigned int from) {
+			size_t a = (size_t)to * this->channels;
+			size_t b = (size_t)from * this->channels;
+
+			for (unsigned int c = 0; c < this->channels; c++) {
+				switch (this->format) {
+				case PassFormat::U8: this->bytes[a + c] = source.bytes[b + c]; break;
+				case PassFormat::Half: this->halves[a + c] = source.halves[b + c]; break;
+				case PassFormat::Float: this->floats[a + c] = source.floats[b + c]; break;
+				}
+			}
+		}
+
+		void copy(unsigned int to, unsigned int from) {
+			this->copy(to, *this, from);
+		}
+
+		void fill(float value) {
+			switch (this->format) {
+			case PassFormat::U8: std::fill(this->bytes.begin(), this->bytes.end(), (uint8_t)std::min(std::max(value * this->scale + .5f, 0.f), 255.f)); break;
+			case PassFormat::Half: std::fill(this->halves.begin(), this->halves.end(), floatToHalf(value)); break;
+			case PassFormat::Float: std::fill(this->floats.begin(), this->floats.end(), value); break;
+			}
+		}
+
+		// Values of count pixels from first on, the channels of each pixel
+		// at out[0, channels) with pixels stride floats apart
+		void unpack(unsigned int first, unsigned int count, float* out, unsigned int stride) const {
+			size_t i = (size_t)first * this->channels;
+			float inverse = 1 / this->scale;
+
+			switch (this->format) {
+			case PassFormat::U8: this->unpackValues(&this->bytes[i], count, out, stride, [inverse](uint8_t value) { return value * inverse; }); break;
+			case PassFormat::Half: this->unpackValues(&this->halves[i], count, out, stride, [](uint16_t value) { return halfToFloat(value); }); break;
+			case PassFormat::Float: this->unpackValues(&this->floats[i], count, out, stride, [](float value) { return value; }); break;
+			}
+		}
+
+		unsigned int getChannels() const {
+			return this->channels;
+		}
+
+		PassFormat getFormat() const {
+			return this->format;
+		}
+
+		size_t memoryUsage() const {
+			return this->bytes.size() + this->halves.size() * 2 + this->floats.size() * 4;
+		}
+
+	private:
+		unsigned int channels;
+		PassFormat format;
+
+		// The channel count as a constant lets the compiler unroll the
+		// common layouts
+		template<typename T, typename Convert>
+		void unpackValues(const T* values, unsigned int count, float* out, unsigned int stride, Convert convert) const {
+			if (stride == this->channels) {
+				for (unsigned int i = 0; i < count * stride; i++) out[i] = convert(values[i]);
+				return;
+			}
+
+			switch (this->channels) {
+			case 1: unpackValues<1>(values, count, out, stride, convert); break;
+			case 3: unpackValues<3>(values, count, out, stride, convert); break;
+			default:
+				for (unsigned int p = 0; p < count; p++) {
+					for (unsigned int c = 0; c < this->channels; c++) out[p * stride + c] = convert(values[p * this->channels + c]);
+				}
+			}
+		}
+
+		template<unsigned int C, typename T, typename Convert>
+		static void unpackValues(const T* values, unsigned int count, float* out, unsigned int stride, Convert convert) {
+			for (unsigned int p = 0; p < count; p++) {
+				for (unsigned int c = 0; c < C; c++) out[p * stride + c] = convert(values[p * C + c]);
+			}
+		}
+		float scale;
+
+		// Only the one of the format is allocated
+		std::vector<uint8_t> bytes;
+		std::vector<uint16_t> halves;
+		std::vector<float> floats;
+	};
+}
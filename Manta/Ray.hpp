@@ -1,8 +1,12 @@
 #pragma once
 
-#include <SFML/Graphics.hpp>
+#include <math.h>
 
-#include "Scene.hpp";
+#include <SFML/System.hpp>
+
+#include "SceneSnapshot.hpp"
+#include "StepTrace.hpp"
+#include "Detail.hpp"
 
 namespace Manta {
 	class Ray {
@@ -10,40 +14,57 @@ namespace Manta {
 		float distance = 0;
 
 		float step() {
-			float sceneIndex = Scene::sceneIndex(
-				this->steps[0],
-				this->scene->getShapes(),
+			uint64_t estimatesBefore = RenderStats::isEnabled() ? RenderStats::local().distanceEstimates : 0;
+
+			Detail::setFootprint(this->footprintAngle * this->distance);
+
+			float sceneIndex = this->scene->sceneIndex(
+				this->position,
 				&this->closestShape,
 				&this->closestIndex
 			);
 
-			sf::Vector3f newPos = this->steps[0] + this->direction * sceneIndex;
+			if (RenderStats::isEnabled()) this->estimates += (unsigned int)(RenderStats::local().distanceEstimates - estimatesBefore);
 
-			this->steps.insert(this->steps.begin(), newPos);
-			this->distance += sceneIndex;
-
-			return sceneIndex;
+			return this->advance(sceneIndex);
 		}
 
 		void manualStep(float distance) {
-			sf::Vector3f newPos = this->steps[0] + this->direction * distance;
-
-			this->steps.insert(this->steps.begin(), newPos);
+			this->position += this->direction * distance;
 			this->distance += distance;
+
+			// Nothing to compare the next relaxed step against
+			this->stepLength = 0;
+
+			if (StepTrace::isEnabled()) StepTrace::local().record(this->position, distance, false);
+		}
+
+		// Over-relaxed sphere tracing (Keinert et al.), every step covers
+		// relaxation times the scene index. 1 is plain sphere tracing.
+		void setRelaxation(float relaxation) {
+			this->relaxation = relaxation;
+		}
+
+		// Angle the pixel of the ray covers, queries ask for the Detail
+		// footprint it has at the distance marched. 0 asks for full detail.
+		void setFootprintAngle(float angle) {
+			this->footprintAngle = angle;
 		}
 
 		sf::Vector3f getPosition() {
-			return this->steps[0];
+			return this->position;
 		}
 
 
-		Ray(sf::Vector3f position, sf::Vector3f direction, Scene* scene) {
-			this->steps.insert(this->steps.begin(), position);
+		Ray(sf::Vector3f position, sf::Vector3f direction, const SceneSnapshot* scene) {
+			this->position = position;
 			this->direction = direction;
 			this->scene = scene;
+
+			if (StepTrace::isEnabled()) StepTrace::local().record(position, 0, true);
 		}
 
-		Shape* getClosest() {
+		const Shape* getClosest() {
 			return this->closestShape;
 		}
 
@@ -51,13 +72,70 @@ namespace Manta {
 			return this->closestIndex;
 		}
 
+		// Scene queries so far, manual steps don't count
+		unsigned int getSteps() {
+			return this->steps;
+		}
+
+		// Shape distance estimates behind those queries, only counted
+		// while RenderStats is enabled
+		unsigned int getEstimates() {
+			return this->estimates;
+		}
+
 	private:
-		std::vector<sf::Vector3f> steps;
+		// Only the current step is kept, see StepTrace for the history
+		sf::Vector3f position;
 		sf::Vector3f direction;
-		Scene* scene;
+		const SceneSnapshot* scene;
 
-		Shape* closestShape = nullptr;
+		const Shape* closestShape = nullptr;
 		unsigned int closestIndex = 0;
+
+		unsigned int steps = 0;
+		unsigned int estimates = 0;
+
+		float relaxation = 1;
+		float footprintAngle = 0;
+
+		// Point, distance and scene index before the last step, and how far
+		// that step went
+		sf::Vector3f previousPosition;
+		float previousDistance = 0;
+		float previousRadius = 0;
+		float stepLength = 0;
+
+		// Moves by the scene index just measured. Returns the bound the
+		// caller compares against clampThreshold.
+		float advance(float sceneIndex) {
+			this->steps++;
+			float radius = fabsf(sceneIndex);
+
+			if (this->relaxation > 1 && radius + this->previousRadius < this->stepLength) {
+				// The unbounding spheres of the last two points don't overlap,
+				// so the relaxed step may have jumped over a surface. Take the
+				// plain step from the previous point instead and stay plain.
+				this->position = this->previousPosition + this->direction * this->previousRadius;
+				this->distance = this->previousDistance + this->previousRadius;
+				this->stepLength = this->previousRadius;
+				this->relaxation = 1;
+
+				sceneIndex = this->previousRadius;
+			}
+			else {
+				this->previousPosition = this->position;
+				this->previousDistance = this->distance;
+				this->previousRadius = radius;
+				this->stepLength = sceneIndex * this->relaxation;
+
+				this->position += this->direction * this->stepLength;
+				this->distance += this->stepLength;
+			}
+
+			if (StepTrace::isEnabled()) StepTrace::local().record(this->position, sceneIndex, false);
+
+			return sceneIndex;
+		}
 	};
 
 	class LightRay {
@@ -65,57 +143,64 @@ namespace Manta {
 		float distance = 0;
 
 		float step() {
-			float sceneIndex = Scene::sceneIndex(
-				this->steps[0],
-				this->scene->getShapes(),
+			uint64_t estimatesBefore = RenderStats::isEnabled() ? RenderStats::local().distanceEstimates : 0;
+
+			float sceneIndex = this->scene->sceneIndex(
+				this->position,
 				&this->closestShape,
 				&this->closestIndex
 			);
 
-			sf::Vector3f newPos = this->steps[0] + this->direction * sceneIndex;
-
-			this->steps.insert(this->steps.begin(), newPos);
-			this->distance += sceneIndex;
+			if (RenderStats::isEnabled()) this->estimates += (unsigned int)(RenderStats::local().distanceEstimates - estimatesBefore);
 
-			return sceneIndex;
+			return this->advance(sceneIndex);
 		}
 
 		float step(unsigned int indexIgnored) {
-			float sceneIndex = Scene::sceneIndex(
-				this->steps[0],
-				this->scene->getShapes(),
+			uint64_t estimatesBefore = RenderStats::isEnabled() ? RenderStats::local().distanceEstimates : 0;
+
+			float sceneIndex = this->scene->sceneIndex(
+				this->position,
 				&this->closestShape,
 				&this->closestIndex,
 				indexIgnored
 			);
 
-			sf::Vector3f newPos = this->steps[0] + this->direction * sceneIndex;
-
-			this->steps.insert(this->steps.begin(), newPos);
-			this->distance += sceneIndex;
+			if (RenderStats::isEnabled()) this->estimates += (unsigned int)(RenderStats::local().distanceEstimates - estimatesBefore);
 
-			return sceneIndex;
+			return this->advance(sceneIndex);
 		}
 
 		void manualStep(float distance) {
-			sf::Vector3f newPos = this->steps[0] + this->direction * distance;
-
-			this->steps.insert(this->steps.begin(), newPos);
+			this->position += this->direction * distance;
 			this->distance += distance;
+
+			// Nothing to compare the next relaxed step against
+			this->stepLength = 0;
+
+			if (StepTrace::isEnabled()) StepTrace::local().record(this->position, distance, false);
+		}
+
+		// Over-relaxed sphere tracing (Keinert et al.), every step covers
+		// relaxation times the scene index. 1 is plain sphere tracing.
+		void setRelaxation(float relaxation) {
+			this->relaxation = relaxation;
 		}
 
 		sf::Vector3f getPosition() {
-			return this->steps[0];
+			return this->position;
 		}
 
 
-		LightRay(sf::Vector3f position, sf::Vector3f direction, Scene* scene) {
-			this->steps.insert(this->steps.begin(), position);
+		LightRay(sf::Vector3f position, sf::Vector3f direction, const SceneSnapshot* scene) {
+			this->position = position;
 			this->direction = direction;
 			this->scene = scene;
+
+			if (StepTrace::isEnabled()) StepTrace::local().record(position, 0, true);
 		}
 
-		Shape* getClosest() {
+		const Shape* getClosest() {
 			return this->closestShape;
 		}
 
@@ -123,12 +208,68 @@ namespace Manta {
 			return this->closestIndex;
 		}
 
+		// Scene queries so far, manual steps don't count
+		unsigned int getSteps() {
+			return this->steps;
+		}
+
+		// Shape distance estimates behind those queries, only counted
+		// while RenderStats is enabled
+		unsigned int getEstimates() {
+			return this->estimates;
+		}
+
 	private:
-		std::vector<sf::Vector3f> steps;
+		// Only the current step is kept, see StepTrace for the history
+		sf::Vector3f position;
 		sf::Vector3f direction;
-		Scene* scene;
+		const SceneSnapshot* scene;
 
-		Shape* closestShape = nullptr;
+		const Shape* closestShape = nullptr;
 		unsigned int closestIndex = 0;
+
+		unsigned int steps = 0;
+		unsigned int estimates = 0;
+
+		float relaxation = 1;
+
+		// Point, distance and scene index before the last step, and how far
+		// that step went
+		sf::Vector3f previousPosition;
+		float previousDistance = 0;
+		float previousRadius = 0;
+		float stepLength = 0;
+
+		// Moves by the scene index just measured. Returns the bound the
+		// caller compares against clampThreshold.
+		float advance(float sceneIndex) {
+			this->steps++;
+			float radius = fabsf(sceneIndex);
+
+			if (this->relaxation > 1 && radius + this->previousRadius < this->stepLength) {
+				// The unbounding spheres of the last two points don't overlap,
+				// so the relaxed step may have jumped over a surface. Take the
+				// plain step from the previous point instead and stay plain.
+				this->position = this->previousPosition + this->direction * this->previousRadius;
+				this->distance = this->previousDistance + this->previousRadius;
+				this->stepLength = this->previousRadius;
+				this->relaxation = 1;
+
+				sceneIndex = this->previousRadius;
+			}
+			else {
+				this->previousPosition = this->position;
+				this->previousDistance = this->distance;
+				this->previousRadius = radius;
+				this->stepLength = sceneIndex * this->relaxation;
+
+				this->position += this->direction * this->stepLength;
+				this->distance += this->stepLength;
+			}
+
+			if (StepTrace::isEnabled()) StepTrace::local().record(this->position, sceneIndex, false);
+
+			return sceneIndex;
+		}
 	};
 }
\ No newline at end of file
@@ -0,0 +1,292 @@
+#pragma once
+
+#include <limits>
+
+#include <SFML/System.hpp>
+
+#include "SceneSnapshot.hpp"
+#include "Simd.hpp"
+
+namespace Manta {
+
+	// N neighbouring rays marched together. Positions and directions are
+	// kept as structure of arrays so the scene queries and the per step
+	// update run on full vector registers, lanes that hit or escaped are
+	// masked out until the whole packet is done.
+	template<unsigned int N>
+	class RayPacket {
+	public:
+		static const unsigned int SIZE = N;
+
+		// Bit i set while lane i still marches / after lane i hit a surface
+		unsigned int active = 0;
+		unsigned int hit = 0;
+
+		// Marches every active lane by one scene index. Lanes escape at
+		// maxDistance or the end given to clip(), whichever comes first.
+		// Returns the mask of lanes that are still active afterwards.
+		unsigned int step(float clampThreshold, float maxDistance) {
+			bool stats = RenderStats::isEnabled();
+
+			const simd::vfloat angle = simd::set(this->footprintAngle);
+			alignas(64) float footprints[simd::WIDTH];
+
+			// One scene query per vector of lanes
+			for (unsigned int i = 0; i < STORAGE; i += simd::WIDTH) {
+				unsigned int lanes = (this->active >> i) & ((1u << simd::WIDTH) - 1);
+
+				// Zero length steps never fail the relaxation test, so
+				// finished lanes stay where they are, the query returns 0
+				// for them
+				for (unsigned int lane = i; lane < i + simd::WIDTH; lane++) {
+					if (!(lanes & (1u << (lane - i)))) this->stepLength[lane] = 0;
+				}
+
+				if (lanes == 0) {
+					simd::store(&this->sceneIndex[i], simd::set(0));
+					continue;
+				}
+
+				simd::store(footprints, simd::mul(angle, simd::load(&this->distance[i])));
+
+				simd::store(&this->sceneIndex[i], this->scene->sceneIndex(
+					simd::load(&this->x[i]),
+					simd::load(&this->y[i]),
+					simd::load(&this->z[i]),
+					lanes,
+					footprints,
+					&this->closestShape[i],
+					&this->closestIndex[i],
+					stats ? &this->estimates[i] : nullptr
+				));
+			}
+
+			for (unsigned int i = 0; i < N; i++) {
+				if (this->active & (1u << i)) this->steps[i]++;
+			}
+
+			const simd::vfloat clamp = simd::set(clampThreshold);
+			const simd::vfloat maxLimit = simd::set(maxDistance);
+
+			unsigned int hitBits = 0;
+			unsigned int escapedBits = 0;
+
+			for (unsigned int i = 0; i < STORAGE; i += simd::WIDTH) {
+				simd::vfloat index = simd::load(&this->sceneIndex[i]);
+				simd::vfloat limit = simd::min(maxLimit, simd::load(&this->end[i]));
+
+				if (this->relaxed) {
+					index = this->relaxedStep(i, index);
+
+					hitBits |= simd::bits(simd::lessEqual(index, clamp)) << i;
+					escapedBits |= simd::bits(simd::greaterEqual(simd::load(&this->distance[i]), limit)) << i;
+					continue;
+				}
+
+				simd::store(&this->x[i], simd::add(simd::load(&this->x[i]), simd::mul(simd::load(&this->dx[i]), index)));
+				simd::store(&this->y[i], simd::add(simd::load(&this->y[i]), simd::mul(simd::load(&this->dy[i]), index)));
+				simd::store(&this->z[i], simd::add(simd::load(&this->z[i]), simd::mul(simd::load(&this->dz[i]), index)));
+
+				simd::vfloat distance = simd::add(simd::load(&this->distance[i]), index);
+				simd::store(&this->distance[i], distance);
+
+				hitBits |= simd::bits(simd::lessEqual(index, clamp)) << i;
+				escapedBits |= simd::bits(simd::greaterEqual(distance, limit)) << i;
+			}
+
+			// Same order as the scalar loop: a lane that got closer than the
+			// threshold counts as hit even if it also passed maxDistance
+			hitBits &= this->active;
+			escapedBits &= this->active & ~hitBits;
+
+			this->hit |= hitBits;
+			this->active &= ~(hitBits | escapedBits);
+
+			return this->active;
+		}
+
+		void manualStep(float distance) {
+			for (unsigned int i = 0; i < N; i++) {
+				this->x[i] += this->dx[i] * distance;
+				this->y[i] += this->dy[i] * distance;
+				this->z[i] += this->dz[i] * distance;
+				this->distance[i] += distance;
+				this->stepLength[i] = 0;
+			}
+		}
+
+		// Restricts lane to [start, end) of its ray, e.g. the part inside
+		// the scene bound. Moves it forward to start, a lane with nothing
+		// left to march is done without hitting anything.
+		void clip(unsigned int lane, float start, float end) {
+			if (start >= end) {
+				this->active &= ~(1u << lane);
+				return;
+			}
+
+			if (start > this->distance[lane]) {
+				float skip = start - this->distance[lane];
+
+				this->x[lane] += this->dx[lane] * skip;
+				this->y[lane] += this->dy[lane] * skip;
+				this->z[lane] += this->dz[lane] * skip;
+				this->distance[lane] += skip;
+			}
+
+			this->end[lane] = end;
+		}
+
+		// Pixel angle of every lane, see Ray::setFootprintAngle
+		void setFootprintAngle(float angle) {
+			this->footprintAngle = angle;
+		}
+
+		// Over-relaxed sphere tracing for every lane, see Ray::setRelaxation
+		void setRelaxation(float relaxation) {
+			for (unsigned int i = 0; i < STORAGE; i++) this->relaxation[i] = relaxation;
+			this->relaxed = relaxation > 1;
+		}
+
+		void march(float clampThreshold, float maxDistance) {
+			while (this->step(clampThreshold, maxDistance));
+		}
+
+		sf::Vector3f getPosition(unsigned int lane) {
+			return sf::Vector3f(this->x[lane], this->y[lane], this->z[lane]);
+		}
+
+		float getDistance(unsigned int lane) {
+			return this->distance[lane];
+		}
+
+		bool isHit(unsigned int lane) {
+			return (this->hit & (1u << lane)) != 0;
+		}
+
+		const Shape* getClosest(unsigned int lane) {
+			return this->closestShape[lane];
+		}
+
+		unsigned int getClosestIndex(unsigned int lane) {
+			return this->closestIndex[lane];
+		}
+
+		unsigned int getSteps(unsigned int lane) {
+			return this->steps[lane];
+		}
+
+		// Only counted while RenderStats is enabled
+		unsigned int getEstimates(unsigned int lane) {
+			return this->estimates[lane];
+		}
+
+		// Only the first count lanes are marched, the rest stay inactive
+		RayPacket(sf::Vector3f position, const sf::Vector3f* directions, unsigned int count, const SceneSnapshot* scene) {
+			this->scene = scene;
+
+			for (unsigned int i = 0; i < STORAGE; i++) {
+				sf::Vector3f direction = i < count ? directions[i] : sf::Vector3f();
+
+				this->x[i] = position.x;
+				this->y[i] = position.y;
+				this->z[i] = position.z;
+				this->dx[i] = direction.x;
+				this->dy[i] = direction.y;
+				this->dz[i] = direction.z;
+				this->distance[i] = 0;
+				this->sceneIndex[i] = 0;
+				this->end[i] = std::numeric_limits<float>::infinity();
+
+				this->previousX[i] = position.x;
+				this->previousY[i] = position.y;
+				this->previousZ[i] = position.z;
+				this->previousDistance[i] = 0;
+				this->previousRadius[i] = 0;
+				this->stepLength[i] = 0;
+				this->relaxation[i] = 1;
+			}
+
+			for (unsigned int i = 0; i < N; i++) {
+				this->closestShape[i] = nullptr;
+				this->closestIndex[i] = 0;
+				this->steps[i] = 0;
+				this->estimates[i] = 0;
+			}
+
+			this->active = count >= 32 ? ~0u : (1u << count) - 1;
+		}
+
+	private:
+		static const unsigned int STORAGE = simd::padded(N);
+
+		alignas(64) float x[STORAGE];
+		alignas(64) float y[STORAGE];
+		alignas(64) float z[STORAGE];
+
+		alignas(64) float dx[STORAGE];
+		alignas(64) float dy[STORAGE];
+		alignas(64) float dz[STORAGE];
+
+		alignas(64) float distance[STORAGE];
+		alignas(64) float sceneIndex[STORAGE];
+		alignas(64) float end[STORAGE];
+
+		// Relaxation state per lane, see Ray::advance
+		alignas(64) float previousX[STORAGE];
+		alignas(64) float previousY[STORAGE];
+		alignas(64) float previousZ[STORAGE];
+		alignas(64) float previousDistance[STORAGE];
+		alignas(64) float previousRadius[STORAGE];
+		alignas(64) float stepLength[STORAGE];
+		alignas(64) float relaxation[STORAGE];
+
+		bool relaxed = false;
+		float footprintAngle = 0;
+
+		const Shape* closestShape[N];
+		unsigned int closestIndex[N];
+		unsigned int steps[N];
+		unsigned int estimates[N];
+
+		const SceneSnapshot* scene;
+
+		// Relaxed update of lanes [i, i + WIDTH). Lanes whose unbounding
+		// spheres stopped overlapping go back to the previous point and
+		// march plain from there. Returns the scene index to test against
+		// clampThreshold.
+		simd::vfloat relaxedStep(unsigned int i, simd::vfloat index) {
+			const simd::vfloat one = simd::set(1);
+
+			simd::vfloat radius = simd::abs(index);
+			simd::vfloat relax = simd::load(&this->relaxation[i]);
+			simd::vfloat previousRadius = simd::load(&this->previousRadius[i]);
+
+			simd::vmask fail = simd::both(
+				simd::lessThan(one, relax),
+				simd::lessThan(simd::add(radius, previousRadius), simd::load(&this->stepLength[i]))
+			);
+
+			simd::vfloat length = simd::select(fail, simd::mul(index, relax), previousRadius);
+
+			simd::vfloat x = simd::select(fail, simd::load(&this->x[i]), simd::load(&this->previousX[i]));
+			simd::vfloat y = simd::select(fail, simd::load(&this->y[i]), simd::load(&this->previousY[i]));
+			simd::vfloat z = simd::select(fail, simd::load(&this->z[i]), simd::load(&this->previousZ[i]));
+			simd::vfloat distance = simd::select(fail, simd::load(&this->distance[i]), simd::load(&this->previousDistance[i]));
+
+			simd::store(&this->previousX[i], x);
+			simd::store(&this->previousY[i], y);
+			simd::store(&this->previousZ[i], z);
+			simd::store(&this->previousDistance[i], distance);
+			simd::store(&this->previousRadius[i], simd::select(fail, radius, previousRadius));
+			simd::store(&this->stepLength[i], length);
+			simd::store(&this->relaxation[i], simd::select(fail, relax, one));
+
+			simd::store(&this->x[i], simd::add(x, simd::mul(simd::load(&this->dx[i]), length)));
+			simd::store(&this->y[i], simd::add(y, simd::mul(simd::load(&this->dy[i]), length)));
+			simd::store(&this->z[i], simd::add(z, simd::mul(simd::load(&this->dz[i]), length)));
+			simd::store(&this->distance[i], simd::add(distance, length));
+
+			return simd::select(fail, index, previousRadius);
+		}
+	};
+}
@@ -0,0 +1,214 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+
+namespace Manta {
+
+	// Opt-in counters for benchmarks and diagnostics. Every thread counts
+	// into its own copy and the camera adds it to the global totals after
+	// each tile with relaxed atomic adds, so rendering never takes a lock
+	// or contends on shared counters. Disabled it costs one relaxed load
+	// per ray.
+	class RenderStats {
+	public:
+		// Histogram buckets for steps per primary ray, the last one also
+		// holds every ray that needed more
+		static const unsigned int MAX_STEPS = 1024;
+
+		uint64_t primaryRays = 0;
+		uint64_t primarySteps = 0;
+		uint64_t shadowRays = 0;
+		uint64_t shadowSteps = 0;
+
+		// Calls into the scene, and the shape distance estimates they
+		// needed, one per shape the scene had to look at
+		uint64_t sceneIndexCalls = 0;
+		uint64_t distanceEstimates = 0;
+
+		// Calls answered by the distance cache without any estimate
+		uint64_t cachedCalls = 0;
+
+		// Pixels a frame took over from the previous one instead of marching
+		uint64_t reprojectedPixels = 0;
+
+		// Primary and shadow rays that ended at clampThreshold (hit or
+		// occluded) or went past maxDistance
+		uint64_t terminatedRays = 0;
+		uint64_t escapedRays = 0;
+
+		// Summed over all workers
+		double albedoSeconds = 0;
+		double shadowSeconds = 0;
+		double aoSeconds = 0;
+
+		uint64_t stepHistogram[MAX_STEPS] = {};
+
+		static void setEnabled(bool enabled) {
+			enabledFlag().store(enabled, std::memory_order_relaxed);
+		}
+
+		static bool isEnabled() {
+			return enabledFlag().load(std::memory_order_relaxed);
+		}
+
+		// Counters of the calling thread
+		static RenderStats& local() {
+			thread_local RenderStats stats;
+			return stats;
+		}
+
+		// Adds the calling thread's counters to the global totals
+		static void flush() {
+			RenderStats& stats = local();
+			Totals& totals = globalTotals();
+
+			add(totals.primaryRays, stats.primaryRays);
+			add(totals.primarySteps, stats.primarySteps);
+			add(totals.shadowRays, stats.shadowRays);
+			add(totals.shadowSteps, stats.shadowSteps);
+			add(totals.sceneIndexCalls, stats.sceneIndexCalls);
+			add(totals.distanceEstimates, stats.distanceEstimates);
+			add(totals.cachedCalls, stats.cachedCalls);
+			add(totals.reprojectedPixels, stats.reprojectedPixels);
+			add(totals.terminatedRays, stats.terminatedRays);
+			add(totals.escapedRays, stats.escapedRays);
+			add(totals.albedoNanoseconds, (uint64_t)(stats.albedoSeconds * 1e9));
+			add(totals.shadowNanoseconds, (uint64_t)(stats.shadowSeconds * 1e9));
+			add(totals.aoNanoseconds, (uint64_t)(stats.aoSeconds * 1e9));
+
+			for (unsigned int i = 0; i < MAX_STEPS; i++) add(totals.stepHistogram[i], stats.stepHistogram[i]);
+
+			stats.clear();
+		}
+
+		// Snapshot of everything flushed since the last reset()
+		static RenderStats totals() {
+			Totals& totals = globalTotals();
+			RenderStats stats;
+
+			stats.primaryRays = totals.primaryRays.load(std::memory_order_relaxed);
+			stats.primarySteps = totals.primarySteps.load(std::memory_order_relaxed);
+			stats.shadowRays = totals.shadowRays.load(std::memory_order_relaxed);
+			stats.shadowSteps = totals.shadowSteps.load(std::memory_order_relaxed);
+			stats.sceneIndexCalls = totals.sceneIndexCalls.load(std::memory_order_relaxed);
+			stats.distanceEstimates = totals.distanceEstimates.load(std::memory_order_relaxed);
+			stats.cachedCalls = totals.cachedCalls.load(std::memory_order_relaxed);
+			stats.reprojectedPixels = totals.reprojectedPixels.load(std::memory_order_relaxed);
+			stats.terminatedRays = totals.terminatedRays.load(std::memory_order_relaxed);
+			stats.escapedRays = totals.escapedRays.load(std::memory_order_relaxed);
+			stats.albedoSeconds = totals.albedoNanoseconds.load(std::memory_order_relaxed) * 1e-9;
+			stats.shadowSeconds = totals.shadowNanoseconds.load(std::memory_order_relaxed) * 1e-9;
+			stats.aoSeconds = totals.aoNanoseconds.load(std::memory_order_relaxed) * 1e-9;
+
+			for (unsigned int i = 0; i < MAX_STEPS; i++) {
+				stats.stepHistogram[i] = totals.stepHistogram[i].load(std::memory_order_relaxed);
+			}
+
+			return stats;
+		}
+
+		static void reset() {
+			Totals& totals = globalTotals();
+
+			for (auto* counter : {
+				&totals.primaryRays, &totals.primarySteps, &totals.shadowRays, &totals.shadowSteps,
+				&totals.sceneIndexCalls, &totals.distanceEstimates, &totals.cachedCalls, &totals.reprojectedPixels, &totals.terminatedRays, &totals.escapedRays,
+				&totals.albedoNanoseconds, &totals.shadowNanoseconds, &totals.aoNanoseconds
+			}) {
+				counter->store(0, std::memory_order_relaxed);
+			}
+
+			for (auto& bucket : totals.stepHistogram) bucket.store(0, std::memory_order_relaxed);
+		}
+
+		// Seconds on a monotonic clock, for the albedo, shadow and AO timings
+		static double now() {
+			return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+		}
+
+		void recordPrimary(unsigned int steps, bool hit) {
+			this->primaryRays++;
+			this->primarySteps += steps;
+			this->stepHistogram[steps < MAX_STEPS ? steps : MAX_STEPS - 1]++;
+
+			if (hit) this->terminatedRays++;
+			else this->escapedRays++;
+		}
+
+		void recordShadow(unsigned int steps, bool occluded) {
+			this->shadowRays++;
+			this->shadowSteps += steps;
+
+			if (occluded) this->terminatedRays++;
+			else this->escapedRays++;
+		}
+
+		void clear() {
+			*this = RenderStats();
+		}
+
+		// Smallest step count that fraction of all primary rays stays within
+		unsigned int stepPercentile(double fraction) const {
+			uint64_t target = (uint64_t)(fraction * this->primaryRays + .5);
+			uint64_t seen = 0;
+
+			for (unsigned int i = 0; i < MAX_STEPS; i++) {
+				seen += this->stepHistogram[i];
+				if (seen >= target && seen > 0) return i;
+			}
+			return MAX_STEPS - 1;
+		}
+
+		// One counter per line, meant for the console after a render
+		void dump(std::ostream& out) const {
+			out << "primary rays        " << this->primaryRays << "\n"
+				<< "primary steps       " << this->primarySteps << "\n"
+				<< "shadow rays         " << this->shadowRays << "\n"
+				<< "shadow steps        " << this->shadowSteps << "\n"
+				<< "sceneIndex calls    " << this->sceneIndexCalls << "\n"
+				<< "distance estimates  " << this->distanceEstimates << "\n"
+				<< "cached calls        " << this->cachedCalls << "\n"
+				<< "reprojected pixels  " << this->reprojectedPixels << "\n"
+				<< "terminated rays     " << this->terminatedRays << "\n"
+				<< "escaped rays        " << this->escapedRays << "\n"
+				<< "albedo seconds      " << this->albedoSeconds << "\n"
+				<< "shadow seconds      " << this->shadowSeconds << "\n"
+				<< "ao seconds          " << this->aoSeconds << "\n";
+		}
+
+	private:
+		struct Totals {
+			std::atomic<uint64_t> primaryRays{ 0 };
+			std::atomic<uint64_t> primarySteps{ 0 };
+			std::atomic<uint64_t> shadowRays{ 0 };
+			std::atomic<uint64_t> shadowSteps{ 0 };
+			std::atomic<uint64_t> sceneIndexCalls{ 0 };
+			std::atomic<uint64_t> distanceEstimates{ 0 };
+			std::atomic<uint64_t> cachedCalls{ 0 };
+			std::atomic<uint64_t> reprojectedPixels{ 0 };
+			std::atomic<uint64_t> terminatedRays{ 0 };
+			std::atomic<uint64_t> escapedRays{ 0 };
+			std::atomic<uint64_t> albedoNanoseconds{ 0 };
+			std::atomic<uint64_t> shadowNanoseconds{ 0 };
+			std::atomic<uint64_t> aoNanoseconds{ 0 };
+			std::atomic<uint64_t> stepHistogram[MAX_STEPS] = {};
+		};
+
+		static Totals& globalTotals() {
+			static Totals totals;
+			return totals;
+		}
+
+		static void add(std::atomic<uint64_t>& counter, uint64_t value) {
+			if (value != 0) counter.fetch_add(value, std::memory_order_relaxed);
+		}
+
+		static std::atomic<bool>& enabledFlag() {
+			static std::atomic<bool> flag(false);
+			return flag;
+		}
+	};
+}
@@ -4,7 +4,7 @@
 
 #include <math.h>;
 #include <stdio.h>;
-#include <SFML/Graphics.hpp>;
+#include <SFML/System.hpp>;
 
 namespace Manta {
 
@@ -1,11 +1,25 @@
 #pragma once
 
-#include <SFML/Graphics.hpp>;
+#include <atomic>
+#include <climits>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+
+#include <SFML/System.hpp>;
 
 #include "Shape.hpp";
 #include "Light.hpp";
+#include "SceneSnapshot.hpp"
+#include "ThreadPool.hpp"
+#include "Detail.hpp"
 
 namespace Manta {
+
+	// Shapes and settings as the application edits them. Renders never
+	// read these, they query a SceneSnapshot built by prepare(), so edits
+	// are safe from any thread at any time and never wait for a render.
 	class Scene {
 	public:
 
@@ -18,7 +32,7 @@ namespace Manta {
 
 			if (shapes->size() == 1) return smallest;
 
-			for (uint16_t i = 1; i < shapes->size(); i++) {
+			for (unsigned int i = 1; i < shapes->size(); i++) {
 				float current = (*shapes)[i]->distanceEstimate(input);
 				if (current < smallest) smallest = current;
 			}
@@ -40,7 +54,7 @@ namespace Manta {
 
 			unsigned int targetIndex = 0;
 
-			for (uint16_t i = 1; i < shapes->size(); i++) {
+			for (unsigned int i = 1; i < shapes->size(); i++) {
 				float current = (*shapes)[i]->distanceEstimate(input);
 				if (current < smallest) {
 					smallest = current;
@@ -63,13 +77,11 @@ namespace Manta {
 		) {
 			if (shapes->size() <= 1) return UINT8_MAX;
 
-			float smallest = (*shapes)[0]->distanceEstimate(input);
+			unsigned int targetIndex = ignoredIndex == 0 ? 1 : 0;
 
-			if (shapes->size() == 1) return smallest;
+			float smallest = (*shapes)[targetIndex]->distanceEstimate(input);
 
-			unsigned int targetIndex = 0;
-
-			for (uint16_t i = 1; i < shapes->size(); i++) {
+			for (unsigned int i = targetIndex + 1; i < shapes->size(); i++) {
 				if (i == ignoredIndex) continue;
 
 				float current = (*shapes)[i]->distanceEstimate(input);
@@ -87,45 +99,215 @@ namespace Manta {
 
 		// ---
 
-		sf::Color getColorAt(sf::Vector3f point) {
-			int closestIndex = 0;
-			float distance = this->shapes[0]->distanceEstimate(point);
+		// Latest snapshot prepare() published, null before the first one.
+		// It can be older than the current revision.
+		std::shared_ptr<const SceneSnapshot> snapshot() const {
+			return std::atomic_load(&this->current);
+		}
 
-			for (unsigned int i = 1; i < this->shapes.size(); i++) {
-				float dE = this->shapes[i]->distanceEstimate(point);
-				if (dE < distance) {
-					closestIndex = i;
-					distance = dE;
+		// Snapshot of the current revision, built if there is none yet.
+		// Edits are only blocked while the shapes get copied and baked, the
+		// acceleration structures are built outside the lock and the result
+		// is swapped in atomically. Renders holding an older snapshot keep
+		// it alive and unchanged. Safe from any thread, cameras call it
+		// from their job thread. Work that can be split up runs on pool if
+		// one is given.
+		std::shared_ptr<const SceneSnapshot> prepare(ThreadPool* pool = nullptr) {
+			std::lock_guard<std::mutex> buildLock(this->buildMutex);
+
+			std::shared_ptr<const SceneSnapshot> previous = this->snapshot();
+			if (previous && previous->getRevision() == this->revision.load()) return previous;
+
+			std::shared_ptr<SceneSnapshot> next = std::make_shared<SceneSnapshot>();
+			std::vector<Bounds> shapeBounds;
+			DistanceCacheSettings cacheSettings;
+			std::vector<unsigned int> cacheMarks;
+			bool cacheMarkAll;
+
+			{
+				std::lock_guard<std::mutex> editLock(this->editMutex);
+
+				next->revision = this->revision.load();
+				next->acceleration = this->acceleration;
+				next->skyColor = this->skyColor;
+				next->globalLight = this->globalLight;
+
+				// The snapshot gets transforms of its own, editShape() changes
+				// those of the scene in place
+				next->shapes.reserve(this->shapes.size());
+				shapeBounds.resize(this->shapes.size());
+				for (unsigned int i = 0; i < this->shapes.size(); i++) {
+					next->shapes.push_back(*this->shapes[i]);
+					next->shapes.back().clonePipeline();
+					next->shapes.back().bake();
+					shapeBounds[i] = next->shapes.back().getBounds();
 				}
+
+				cacheSettings = this->cacheSettings;
+				cacheMarks.swap(this->cacheMarks);
+				cacheMarkAll = this->cacheMarkAll;
+				this->cacheMarkAll = false;
+			}
+
+			next->build(shapeBounds);
+
+			// The cache of the previous snapshot may still be in use, so
+			// changes go into a copy
+			if (cacheMarkAll || !cacheMarks.empty() || !(cacheSettings == this->cache->getSettings())) {
+				std::shared_ptr<DistanceCache> cache = std::make_shared<DistanceCache>(*this->cache);
+				cache->configure(cacheSettings);
+				if (cacheMarkAll) cache->markAll();
+				for (unsigned int index : cacheMarks) cache->markShape(index);
+
+				SceneSnapshot* snapshot = next.get();
+				cache->update(next->getBounds(), shapeBounds, [snapshot](sf::Vector3f point, unsigned int* outIndex) {
+					// Bounds for every ray, so at full detail whatever the
+					// worker rendered last
+					Detail::setFootprint(0);
+
+					unsigned int evaluations;
+					return snapshot->search(point, outIndex, SceneSnapshot::NO_INDEX, &evaluations);
+				}, pool);
+
+				this->cache = cache;
 			}
-			return this->shapes[closestIndex]->color;
+			next->cache = this->cache;
+
+			std::shared_ptr<const SceneSnapshot> published = next;
+			std::atomic_store(&this->current, published);
+			return published;
 		}
 
 
-		sf::Color getSkyColor() {
+		Color getSkyColor() {
+			std::lock_guard<std::mutex> lock(this->editMutex);
 			return this->skyColor;
 		}
 
-		void setSkyColor(sf::Color color) {
+		void setSkyColor(Color color) {
+			std::lock_guard<std::mutex> lock(this->editMutex);
 			this->skyColor = color;
+			this->revision++;
+		}
+
+		GlobalLight getGlobalLight() {
+			std::lock_guard<std::mutex> lock(this->editMutex);
+			return this->globalLight;
+		}
+
+		void setGlobalLight(const GlobalLight& light) {
+			std::lock_guard<std::mutex> lock(this->editMutex);
+			this->globalLight = light;
+			this->revision++;
+		}
+
+		void setAcceleration(Acceleration acceleration) {
+			std::lock_guard<std::mutex> lock(this->editMutex);
+			if (this->acceleration == acceleration) return;
+
+			this->acceleration = acceleration;
+			this->revision++;
+		}
+
+		Acceleration getAcceleration() {
+			std::lock_guard<std::mutex> lock(this->editMutex);
+			return this->acceleration;
+		}
+
+		// Far from surfaces sceneIndex() answers from a baked distance cache
+		// instead of evaluating shapes, only worth it for static scenes
+		void setDistanceCache(const DistanceCacheSettings& settings) {
+			std::lock_guard<std::mutex> lock(this->editMutex);
+			if (settings == this->cacheSettings) return;
+
+			this->cacheSettings = settings;
+			this->revision++;
 		}
 
 
 		void mountShape(Shape* shape) {
+			std::lock_guard<std::mutex> lock(this->editMutex);
 			this->shapes.push_back(std::shared_ptr<Shape>(shape));
+			this->markShape((unsigned int)this->shapes.size() - 1);
+		}
+
+		// Runs edit on shape index with other edits and snapshot builds held
+		// off, the way to change the transforms of a mounted shape while
+		// renders may be running
+		void editShape(unsigned int index, const std::function<void(Shape*)>& edit) {
+			std::lock_guard<std::mutex> lock(this->editMutex);
+			edit(this->shapes[index].get());
+			this->markShape(index);
+		}
+
+		// Has to be called after transforms of mounted shapes were edited
+		// in place, so prepare() bakes and builds everything again. Only
+		// safe while nothing renders, see editShape().
+		void invalidate() {
+			std::lock_guard<std::mutex> lock(this->editMutex);
+			this->cacheMarkAll = true;
+			this->cacheMarks.clear();
+			this->revision++;
+		}
+
+		// Cheaper than invalidate() after only the transforms of shape index
+		// were edited, the distance cache keeps the bricks far from it
+		void invalidateShape(unsigned int index) {
+			std::lock_guard<std::mutex> lock(this->editMutex);
+			this->markShape(index);
 		}
 
+		// Changes with every edit that goes through the scene, cameras
+		// cancel renders started on an older revision
+		unsigned int getRevision() {
+			return this->revision.load();
+		}
+
+		unsigned int getShapeCount() {
+			std::lock_guard<std::mutex> lock(this->editMutex);
+			return (unsigned int)this->shapes.size();
+		}
+
+		// The shapes as edited, for setting up a scene. Other threads may
+		// not edit while this is in use.
 		std::vector<std::shared_ptr<Shape>>* getShapes() {
 			return &this->shapes;
 		}
 
-		GlobalLight globalLight;
-
 	private:
+		// Held by edits and while prepare() copies the shapes
+		std::mutex editMutex;
+
+		// One prepare() at a time, the others wait and get its snapshot
+		std::mutex buildMutex;
+
 		std::vector<std::shared_ptr<Shape>> shapes;
 
-		std::vector<std::shared_ptr<Light>> lights;
+		Acceleration acceleration = Acceleration::None;
+
+		Color skyColor;
+		GlobalLight globalLight;
+
+		std::atomic<unsigned int> revision{ 0 };
 
-		sf::Color skyColor;
+		// Only accessed through std::atomic_load() / std::atomic_store()
+		std::shared_ptr<const SceneSnapshot> current;
+
+		// Shapes the distance cache has to rebuild around in the next
+		// snapshot, or all of it
+		DistanceCacheSettings cacheSettings;
+		std::vector<unsigned int> cacheMarks;
+		bool cacheMarkAll = true;
+
+		// The cache of the latest snapshot, only prepare() touches it
+		std::shared_ptr<const DistanceCache> cache = std::make_shared<DistanceCache>();
+
+		// Called with editMutex held
+		void markShape(unsigned int index) {
+			if (!this->cacheMarkAll) this->cacheMarks.push_back(index);
+			this->revision++;
+		}
+
+		std::vector<std::shared_ptr<Light>> lights;
 	};
-}
\ No newline at end of file
+}
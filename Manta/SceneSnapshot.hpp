@@ -0,0 +1,414 @@
+#pragma once
+
+#include <climits>
+#include <limits>
+#include <memory>
+#include <vector>
+
+#include <SFML/System.hpp>
+
+#include "Shape.hpp"
+#include "Light.hpp"
+#include "BVH.hpp"
+#include "CompiledScene.hpp"
+#include "DistanceCache.hpp"
+#include "RenderStats.hpp"
+#include "Simd.hpp"
+
+namespace Manta {
+
+	enum class Acceleration {
+		None,	// Linear scan over all shapes
+		BVH,		// Bounding volume hierarchy over Shape::getBounds()
+		Compiled	// Primitives packed by type and evaluated with SIMD
+	};
+
+	// Everything a render queries of a Scene, frozen at one revision. The
+	// shapes are copied into one array together with their baked
+	// transforms and colours, so later edits of the scene never reach a
+	// snapshot and any number of threads can query it without locks.
+	// Built by Scene::prepare(), a render keeps the one it started with.
+	class SceneSnapshot {
+	public:
+
+		float sceneIndex(const sf::Vector3f input) const {
+			unsigned int closestIndex;
+			float cached;
+			if (this->cachedIndex(input, &cached, &closestIndex)) return cached;
+
+			return this->nearest(input, &closestIndex, NO_INDEX);
+		}
+
+		float sceneIndex(
+			const sf::Vector3f input,
+			const Shape** outClosest,
+			unsigned int* outClosestIndex
+		) const {
+			return this->sceneIndex(input, outClosest, outClosestIndex, NO_INDEX);
+		}
+
+		float sceneIndex(
+			const sf::Vector3f input,
+			const Shape** outClosest,
+			unsigned int* outClosestIndex,
+			unsigned int ignoredIndex
+		) const {
+			unsigned int targetIndex = NO_INDEX;
+			float smallest;
+
+			// A bound with the ignored shape is still one without it
+			if (!this->cachedIndex(input, &smallest, &targetIndex)) {
+				smallest = this->nearest(input, &targetIndex, ignoredIndex);
+			}
+
+			if (targetIndex != NO_INDEX) {
+				*outClosestIndex = targetIndex;
+				*outClosest = &this->shapes[targetIndex];
+			}
+
+			return smallest;
+		}
+
+		// sceneIndex() of the simd::WIDTH points x, y, z at once, for ray
+		// packets. Only lanes set in active are evaluated, the others come
+		// back as 0 and keep their closest shape. Baked spheres and boxes
+		// are evaluated for all lanes in one vector call, other shapes lane
+		// by lane with the Detail footprint footprints[lane]. Compiled
+		// scenes keep their own kernels, lane by lane. While RenderStats is
+		// enabled outEstimates gets the distance estimates of every lane
+		// added.
+		simd::vfloat sceneIndex(
+			const simd::vfloat& x,
+			const simd::vfloat& y,
+			const simd::vfloat& z,
+			unsigned int active,
+			const float* footprints,
+			const Shape** outClosest,
+			unsigned int* outClosestIndex,
+			unsigned int* outEstimates
+		) const {
+			PacketQuery query(x, y, z, footprints);
+			unsigned int pending = 0;
+
+			for (unsigned int lane = 0; lane < simd::WIDTH; lane++) {
+				if (!(active & (1u << lane))) continue;
+
+				if (!this->cachedIndex(query.point(lane), &query.smallest[lane], &query.index[lane])) {
+					query.smallest[lane] = std::numeric_limits<float>::infinity();
+					pending |= 1u << lane;
+				}
+			}
+
+			if (pending != 0) this->nearest(&query, pending, outEstimates);
+
+			for (unsigned int lane = 0; lane < simd::WIDTH; lane++) {
+				if (query.index[lane] == NO_INDEX) continue;
+
+				outClosestIndex[lane] = query.index[lane];
+				outClosest[lane] = &this->shapes[query.index[lane]];
+			}
+
+			return simd::load(query.smallest);
+		}
+
+		Color getColorAt(sf::Vector3f point) const {
+			unsigned int closestIndex = 0;
+			this->nearest(point, &closestIndex, NO_INDEX);
+
+			if (closestIndex == NO_INDEX) return this->skyColor;
+
+			return this->shapes[closestIndex].color;
+		}
+
+		Color getSkyColor() const {
+			return this->skyColor;
+		}
+
+		const GlobalLight& getGlobalLight() const {
+			return this->globalLight;
+		}
+
+		// World space box around every surface, infinite as soon as one
+		// shape is unbounded
+		const Bounds& getBounds() const {
+			return this->bounds;
+		}
+
+		// Same index as in the scene at this revision
+		const Shape& getShape(unsigned int index) const {
+			return this->shapes[index];
+		}
+
+		unsigned int getShapeCount() const {
+			return (unsigned int)this->shapes.size();
+		}
+
+		// Scene revision the snapshot was taken at
+		unsigned int getRevision() const {
+			return this->revision;
+		}
+
+		// What queries use, BVH where a compiled scene would be too large
+		Acceleration getAcceleration() const {
+			return this->acceleration;
+		}
+
+		const DistanceCache& getDistanceCache() const {
+			return *this->cache;
+		}
+
+	private:
+		friend class Scene;
+
+		static const unsigned int NO_INDEX = UINT_MAX;
+
+		unsigned int revision = 0;
+
+		// Contiguous copies, baked where the pipeline allows it. Transforms
+		// that can't be baked stay shared with the scene.
+		std::vector<Shape> shapes;
+
+		Acceleration acceleration = Acceleration::None;
+		Bounds bounds = Bounds::empty();
+
+		BVH bvh;
+
+		// Shapes without a finite bound, tested on every BVH query
+		std::vector<unsigned int> unboundedShapes;
+
+		CompiledScene compiled;
+
+		// Shared with the snapshots before as long as nothing changed
+		std::shared_ptr<const DistanceCache> cache;
+
+		Color skyColor;
+		GlobalLight globalLight;
+
+		// Acceleration structures over shapes, whose world bounds are
+		// shapeBounds
+		void build(const std::vector<Bounds>& shapeBounds) {
+			// Too many shapes to compile, the BVH takes over
+			if (this->acceleration == Acceleration::Compiled && !CompiledScene::supports(this->shapes.size())) {
+				this->acceleration = Acceleration::BVH;
+			}
+
+			this->bounds = Bounds::empty();
+			for (const Bounds& shapeBound : shapeBounds) this->bounds.extend(shapeBound);
+
+			if (this->acceleration == Acceleration::BVH) {
+				std::vector<unsigned int> bounded;
+
+				for (unsigned int i = 0; i < shapeBounds.size(); i++) {
+					if (shapeBounds[i].isInfinite()) this->unboundedShapes.push_back(i);
+					else bounded.push_back(i);
+				}
+
+				this->bvh.build(shapeBounds, bounded);
+			}
+
+			if (this->acceleration == Acceleration::Compiled) {
+				this->compiled.build(this->shapes);
+			}
+		}
+
+		// Lookup in the distance cache, false where the scene has to be
+		// evaluated exactly
+		bool cachedIndex(const sf::Vector3f input, float* outDistance, unsigned int* outIndex) const {
+			if (!this->cache || !this->cache->isReady()) return false;
+
+			unsigned int index = NO_INDEX;
+			float bound = this->cache->lookup(input, &index);
+			if (bound < this->cache->nearDistance()) return false;
+
+			*outDistance = bound;
+			*outIndex = index;
+
+			if (RenderStats::isEnabled()) {
+				RenderStats::local().sceneIndexCalls++;
+				RenderStats::local().cachedCalls++;
+			}
+			return true;
+		}
+
+		float nearest(const sf::Vector3f input, unsigned int* outIndex, unsigned int ignoredIndex) const {
+			unsigned int evaluations = 0;
+			float smallest = this->search(input, outIndex, ignoredIndex, &evaluations);
+
+			if (RenderStats::isEnabled()) {
+				RenderStats::local().sceneIndexCalls++;
+				RenderStats::local().distanceEstimates += evaluations;
+			}
+
+			return smallest;
+		}
+
+		// One vector sceneIndex() call, the points as vectors and per lane
+		struct PacketQuery {
+			simd::vfloat x, y, z;
+
+			alignas(64) float px[simd::WIDTH];
+			alignas(64) float py[simd::WIDTH];
+			alignas(64) float pz[simd::WIDTH];
+
+			const float* footprints;
+
+			// Closest so far, lanes that aren't evaluated keep 0
+			alignas(64) float smallest[simd::WIDTH];
+			unsigned int index[simd::WIDTH];
+
+			// Only counted while RenderStats is enabled
+			unsigned int evaluations[simd::WIDTH];
+
+			PacketQuery(simd::vfloat x, simd::vfloat y, simd::vfloat z, const float* footprints) : x(x), y(y), z(z), footprints(footprints) {
+				simd::store(this->px, x);
+				simd::store(this->py, y);
+				simd::store(this->pz, z);
+
+				for (unsigned int lane = 0; lane < simd::WIDTH; lane++) {
+					this->smallest[lane] = 0;
+					this->index[lane] = NO_INDEX;
+					this->evaluations[lane] = 0;
+				}
+			}
+
+			sf::Vector3f point(unsigned int lane) const {
+				return sf::Vector3f(this->px[lane], this->py[lane], this->pz[lane]);
+			}
+		};
+
+		// Packet version of nearest() for the pending lanes of query, which
+		// start with an infinite smallest distance and no index
+		void nearest(PacketQuery* query, unsigned int pending, unsigned int* outEstimates) const {
+			bool stats = RenderStats::isEnabled();
+
+			// Linear scans keep the first of equal distances, the BVH the
+			// lower index, like the single point versions
+			if (this->acceleration == Acceleration::BVH) {
+				for (unsigned int i : this->unboundedShapes) this->evaluate(query, i, pending, false, stats);
+
+				this->bvh.nearest(query->x, query->y, query->z, pending, query->smallest, [&](unsigned int i, unsigned int lanes) {
+					this->evaluate(query, i, lanes, true, stats);
+				});
+			}
+			else if (this->acceleration == Acceleration::Compiled) {
+				// The compiled kernels already fill their vectors with shapes,
+				// packets only add overhead to them
+				for (unsigned int lane = 0; lane < simd::WIDTH; lane++) {
+					if (!(pending & (1u << lane))) continue;
+
+					Detail::setFootprint(query->footprints[lane]);
+
+					query->smallest[lane] = this->compiled.nearest(query->point(lane), &query->index[lane], NO_INDEX);
+					query->evaluations[lane] += this->compiled.size();
+				}
+			}
+			else {
+				for (unsigned int i = 0; i < this->shapes.size(); i++) this->evaluate(query, i, pending, false, stats);
+			}
+
+			for (unsigned int lane = 0; lane < simd::WIDTH; lane++) {
+				if (!(pending & (1u << lane))) continue;
+
+				if (std::isinf(query->smallest[lane])) query->smallest[lane] = UINT8_MAX;
+
+				if (stats) {
+					RenderStats::local().sceneIndexCalls++;
+					RenderStats::local().distanceEstimates += query->evaluations[lane];
+					if (outEstimates) outEstimates[lane] += query->evaluations[lane];
+				}
+			}
+		}
+
+		// Distance of shape i for the given lanes of query, taken where it
+		// is closer. With lowerIndexWins equal distances go to the lower
+		// index, otherwise the one found first stays.
+		void evaluate(PacketQuery* query, unsigned int i, unsigned int lanes, bool lowerIndexWins, bool count) const {
+			const Shape& shape = this->shapes[i];
+
+			if (count) {
+				for (unsigned int lane = 0; lane < simd::WIDTH; lane++) {
+					if (lanes & (1u << lane)) query->evaluations[lane]++;
+				}
+			}
+
+			if (shape.isVectorized()) {
+				simd::vfloat current = shape.distanceEstimate(query->x, query->y, query->z);
+				simd::vfloat best = simd::load(query->smallest);
+
+				unsigned int closer = lanes & simd::bits(simd::lessThan(current, best));
+				unsigned int equal = lowerIndexWins ? lanes & simd::bits(simd::equal(current, best)) : 0;
+				if ((closer | equal) == 0) return;
+
+				alignas(64) float distances[simd::WIDTH];
+				simd::store(distances, current);
+
+				for (unsigned int lane = 0; lane < simd::WIDTH; lane++) {
+					if ((closer & (1u << lane)) || ((equal & (1u << lane)) && i < query->index[lane])) {
+						query->smallest[lane] = distances[lane];
+						query->index[lane] = i;
+					}
+				}
+				return;
+			}
+
+			for (unsigned int lane = 0; lane < simd::WIDTH; lane++) {
+				if (!(lanes & (1u << lane))) continue;
+
+				Detail::setFootprint(query->footprints[lane]);
+
+				float current = shape.distanceEstimate(query->point(lane), query->smallest[lane]);
+				if (current < query->smallest[lane] || (lowerIndexWins && current == query->smallest[lane] && i < query->index[lane])) {
+					query->smallest[lane] = current;
+					query->index[lane] = i;
+				}
+			}
+		}
+
+		// nearest() without counting, for work that isn't part of a render
+		float search(const sf::Vector3f input, unsigned int* outIndex, unsigned int ignoredIndex, unsigned int* outEvaluations) const {
+			float smallest = std::numeric_limits<float>::infinity();
+			*outIndex = NO_INDEX;
+
+			unsigned int evaluations = 0;
+
+			if (this->acceleration == Acceleration::BVH) {
+				for (unsigned int i : this->unboundedShapes) {
+					if (i == ignoredIndex) continue;
+
+					evaluations++;
+					float current = this->shapes[i].distanceEstimate(input, smallest);
+					if (current < smallest) {
+						smallest = current;
+						*outIndex = i;
+					}
+				}
+
+				smallest = this->bvh.nearest(input, smallest, outIndex, [&](unsigned int i, float best) {
+					if (i == ignoredIndex) return std::numeric_limits<float>::infinity();
+
+					evaluations++;
+					return this->shapes[i].distanceEstimate(input, best);
+				});
+			}
+			else if (this->acceleration == Acceleration::Compiled) {
+				smallest = this->compiled.nearest(input, outIndex, ignoredIndex);
+				evaluations = this->compiled.size();
+			}
+			else {
+				for (unsigned int i = 0; i < this->shapes.size(); i++) {
+					if (i == ignoredIndex) continue;
+
+					evaluations++;
+					float current = this->shapes[i].distanceEstimate(input, smallest);
+					if (current < smallest) {
+						smallest = current;
+						*outIndex = i;
+					}
+				}
+			}
+
+			*outEvaluations = evaluations;
+			return std::isinf(smallest) ? UINT8_MAX : smallest;
+		}
+	};
+}
@@ -0,0 +1,373 @@
+#pragma once
+
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <SFML/System.hpp>
+
+#include "Rotation.hpp"
+#include "Shape.hpp"
+#include "CSG.hpp"
+#include "Instances.hpp"
+#include "Fractals.hpp"
+#include "Transform.hpp"
+#include "Scene.hpp"
+
+namespace Manta {
+
+	// Spheres scattered in front of the default camera, same seed same scene
+	inline void demoScene(Scene* scene, unsigned int seed = 1) {
+		std::mt19937 rng(seed);
+
+		scene->setSkyColor(Color(70, 90, 240));
+
+		for (unsigned int i = 0; i < 20; i++) {
+			auto sphere = Sphere();
+
+			sphere->color = Color(rng() % 255, rng() % 255, rng() % 255);
+
+			sphere->pushTransform(new Translate(sf::Vector3f(
+				(float)(rng() % 10) - 5,
+				(float)(rng() % 20) - 10,
+				(float)(rng() % 20) - 10
+			)));
+
+			scene->mountShape(sphere);
+		}
+	}
+
+	// Reference scenes for benchmarks. All of them are seeded and framed
+	// for the default camera at (-50, 0, 0) looking down +x.
+
+	// Centers a shape at center with the given size along every axis.
+	// Transforms map world points into the shape, so they run backwards.
+	inline void placeShape(Shape* shape, sf::Vector3f center, sf::Vector3f size) {
+		shape->pushTransform(new Translate(-center));
+
+		auto scale = new Scale();
+		scale->factor = size;
+		shape->pushTransform(scale);
+	}
+
+	inline Shape* randomShape(std::mt19937* rng, sf::Vector3f center, float size) {
+		auto shape = (*rng)() % 2 == 0 ? Sphere() : Box();
+		shape->color = Color((*rng)() % 255, (*rng)() % 255, (*rng)() % 255);
+
+		placeShape(shape, center, sf::Vector3f(size, size, size));
+
+		return shape;
+	}
+
+	// 20 shapes spread wide, most primary rays escape into the sky
+	inline void sparseScene(Scene* scene, unsigned int seed = 1) {
+		std::mt19937 rng(seed);
+		std::uniform_real_distribution<float> depth(-10, 30);
+		std::uniform_real_distribution<float> side(-25, 25);
+
+		scene->setSkyColor(Color(70, 90, 240));
+
+		for (unsigned int i = 0; i < 20; i++) {
+			scene->mountShape(randomShape(&rng, sf::Vector3f(depth(rng), side(rng), side(rng)), 1));
+		}
+	}
+
+	// 400 shapes packed tightly, rays pass close to many surfaces
+	inline void denseScene(Scene* scene, unsigned int seed = 1) {
+		std::mt19937 rng(seed);
+		std::uniform_real_distribution<float> position(-10, 10);
+		std::uniform_real_distribution<float> size(.5f, 1.5f);
+
+		scene->setSkyColor(Color(70, 90, 240));
+
+		for (unsigned int i = 0; i < 400; i++) {
+			scene->mountShape(randomShape(&rng, sf::Vector3f(position(rng), position(rng), position(rng) * 1.5f), size(rng)));
+		}
+	}
+
+	// 20000 small shapes, dominated by the scene index lookup
+	inline void manyShapeScene(Scene* scene, unsigned int seed = 1) {
+		std::mt19937 rng(seed);
+		std::uniform_real_distribution<float> position(-20, 20);
+		std::uniform_real_distribution<float> size(.15f, .4f);
+
+		scene->setSkyColor(Color(70, 90, 240));
+
+		for (unsigned int i = 0; i < 20000; i++) {
+			scene->mountShape(randomShape(&rng, sf::Vector3f(position(rng), position(rng), position(rng)), size(rng)));
+		}
+	}
+
+	// Ground and back wall with pillars and spheres in front of them.
+	// Almost every pixel hits, and the shadow rays leaving the wall graze
+	// along its surface in small steps.
+	inline void shadowHeavyScene(Scene* scene, unsigned int seed = 1) {
+		std::mt19937 rng(seed);
+		std::uniform_real_distribution<float> position(-20, 20);
+
+		scene->setSkyColor(Color(70, 90, 240));
+
+		auto ground = Box();
+		ground->color = Color(200, 200, 200);
+		placeShape(ground, sf::Vector3f(0, -11, 0), sf::Vector3f(60, 1, 60));
+		scene->mountShape(ground);
+
+		auto wall = Box();
+		wall->color = Color(180, 170, 160);
+		placeShape(wall, sf::Vector3f(25, 0, 0), sf::Vector3f(1, 40, 60));
+		scene->mountShape(wall);
+
+		for (unsigned int i = 0; i < 40; i++) {
+			auto pillar = Box();
+			pillar->color = Color(rng() % 255, rng() % 255, rng() % 255);
+
+			placeShape(pillar, sf::Vector3f(position(rng) * .5f + 10, -6, position(rng)), sf::Vector3f(.5f, 4, .5f));
+			scene->mountShape(pillar);
+		}
+
+		for (unsigned int i = 0; i < 40; i++) {
+			scene->mountShape(randomShape(&rng, sf::Vector3f(position(rng) * .5f + 10, position(rng) * .4f, position(rng)), 1.5f));
+		}
+	}
+
+	// Plate with rounded corners, a grid of holes drilled through it and
+	// bosses melted onto its front, 41 leaves. Centered on the origin and
+	// facing -x, 2 x 10 x 10 units.
+	inline CSG* machinedPart(std::mt19937* rng) {
+		std::uniform_real_distribution<float> side(-3.5f, 3.5f);
+
+		CSG* tree = new CSG();
+
+		auto box = Box();
+		placeShape(box, sf::Vector3f(), sf::Vector3f(1, 5, 5));
+
+		auto rounding = Sphere();
+		placeShape(rounding, sf::Vector3f(), sf::Vector3f(3, 6.6f, 6.6f));
+
+		unsigned int plate = tree->intersect(tree->leaf(box), tree->leaf(rounding));
+
+		// Row by row, so the balanced union groups neighbouring holes
+		std::vector<unsigned int> holes;
+		for (unsigned int y = 0; y < 6; y++) {
+			for (unsigned int z = 0; z < 6; z++) {
+				auto hole = Sphere();
+				placeShape(hole, sf::Vector3f(0, y * 1.5f - 3.75f, z * 1.5f - 3.75f), sf::Vector3f(2, .45f, .45f));
+				holes.push_back(tree->leaf(hole));
+			}
+		}
+
+		unsigned int part = tree->subtract(plate, tree->unite(holes));
+
+		for (unsigned int i = 0; i < 3; i++) {
+			auto boss = Sphere();
+			placeShape(boss, sf::Vector3f(-1, side(*rng), side(*rng)), sf::Vector3f(.9f, .9f, .9f));
+			part = tree->smoothUnite(part, tree->leaf(boss), .6f);
+		}
+
+		return tree;
+	}
+
+	// Four machined parts, each one CSG tree of 41 leaves. Most of the
+	// leaves are far from any given point, which is what bound pruning
+	// skips.
+	inline void csgScene(Scene* scene, unsigned int seed = 1) {
+		std::mt19937 rng(seed);
+		std::uniform_real_distribution<float> tilt(-.4f, .4f);
+
+		scene->setSkyColor(Color(70, 90, 240));
+
+		for (unsigned int i = 0; i < 4; i++) {
+			auto part = Combined(machinedPart(&rng));
+			part->color = Color(rng() % 255, rng() % 255, rng() % 255);
+
+			part->pushTransform(new Translate(-sf::Vector3f(0, i % 2 == 0 ? -6.f : 6.f, i < 2 ? -6.f : 6.f)));
+
+			auto rotate = new Rotate();
+			rotate->eulerAngles = sf::Vector3f(0, tilt(rng), tilt(rng));
+			part->pushTransform(rotate);
+
+			scene->mountShape(part);
+		}
+	}
+
+	// A floor of boxes repeating forever, a ring of 24 boxes repeated
+	// around the view axis and a cloud of 100000 instanced spheres inside
+	// it. Three shapes in the scene, each step evaluates a few prototypes.
+	inline void instancedScene(Scene* scene, unsigned int seed = 1) {
+		std::mt19937 rng(seed);
+		std::uniform_real_distribution<float> depth(0, 20);
+		std::uniform_real_distribution<float> side(-5, 5);
+		std::uniform_real_distribution<float> size(.06f, .14f);
+		std::uniform_real_distribution<float> angle(0, 3.14159265f);
+
+		scene->setSkyColor(Color(70, 90, 240));
+
+		auto floor = Box();
+		floor->color = Color(200, 200, 200);
+		floor->pushTransform(new Translate(sf::Vector3f(0, 9, 0)));
+		floor->pushTransform(new Repeat(sf::Vector3f(3, 0, 3)));
+		auto tile = new Scale();
+		tile->factor = sf::Vector3f(1.2f, .3f, 1.2f);
+		floor->pushTransform(tile);
+		scene->mountShape(floor);
+
+		auto ring = Box();
+		ring->color = Color(230, 120, 40);
+		ring->pushTransform(new Translate(sf::Vector3f(-10, 0, 0)));
+		ring->pushTransform(new RadialRepeat(24));
+		placeShape(ring, sf::Vector3f(0, 8, 0), sf::Vector3f(.6f, .9f, .6f));
+		scene->mountShape(ring);
+
+		auto prototype = Sphere();
+		auto cloud = new Instances(prototype);
+		for (unsigned int i = 0; i < 100000; i++) {
+			float radius = size(rng);
+			cloud->add(sf::Vector3f(depth(rng), side(rng), side(rng)), sf::Vector3f(radius, radius * .6f, radius), sf::Vector3f(angle(rng), angle(rng), 0));
+		}
+
+		auto instanced = Instanced(cloud);
+		instanced->color = Color(90, 200, 160);
+		scene->mountShape(instanced);
+	}
+
+	// Mandelbulb, Menger sponge and Mandelbox in front, and a row of
+	// sponges running off into the distance, so the same fractal is seen
+	// from a pixel footprint of a few hundredths up to almost a unit
+	inline void fractalScene(Scene* scene, unsigned int seed = 1) {
+		std::mt19937 rng(seed);
+
+		scene->setSkyColor(Color(70, 90, 240));
+
+		auto bulb = Mandelbulb();
+		bulb->color = Color(220, 140, 60);
+		placeShape(bulb, sf::Vector3f(-15, 1, -7), sf::Vector3f(3.5f, 3.5f, 3.5f));
+		scene->mountShape(bulb);
+
+		auto sponge = MengerSponge();
+		sponge->color = Color(200, 200, 210);
+		sponge->pushTransform(new Translate(-sf::Vector3f(0, -1, 2)));
+		auto turn = new Rotate();
+		turn->eulerAngles = sf::Vector3f(.3f, .6f, 0);
+		sponge->pushTransform(turn);
+		auto size = new Scale();
+		size->factor = sf::Vector3f(4, 4, 4);
+		sponge->pushTransform(size);
+		scene->mountShape(sponge);
+
+		auto box = Mandelbox();
+		box->color = Color(90, 170, 220);
+		placeShape(box, sf::Vector3f(15, 2, 14), sf::Vector3f(7, 7, 7));
+		scene->mountShape(box);
+
+		for (unsigned int i = 0; i < 8; i++) {
+			auto distant = MengerSponge();
+			distant->color = Color(rng() % 255, rng() % 255, rng() % 255);
+			placeShape(distant, sf::Vector3f(5 + i * 6.f, -8, -14 + i * 2.f), sf::Vector3f(2, 2, 2));
+			scene->mountShape(distant);
+		}
+	}
+
+	// Any of the scenes above by name: demo, sparse, dense, many, shadow,
+	// csg, instanced, fractal
+	inline bool builtinScene(const std::string& name, Scene* scene, unsigned int seed = 1) {
+		if (name == "demo") demoScene(scene, seed);
+		else if (name == "sparse") sparseScene(scene, seed);
+		else if (name == "dense") denseScene(scene, seed);
+		else if (name == "many") manyShapeScene(scene, seed);
+		else if (name == "shadow") shadowHeavyScene(scene, seed);
+		else if (name == "csg") csgScene(scene, seed);
+		else if (name == "instanced") instancedScene(scene, seed);
+		else if (name == "fractal") fractalScene(scene, seed);
+		else return false;
+
+		return true;
+	}
+
+	// Reads a scene description, one command per line, # starts a comment:
+	//
+	//   sky r g b
+	//   light dx dy dz
+	//   sphere r g b | box r g b      starts a new unit sized shape
+	//   scale x y z                   places the last shape, applied in
+	//   rotate x y z                  the order given, rotate turns it by
+	//   translate x y z               euler angles in degrees, x, z then y
+	//
+	// On failure outError says which line was wrong.
+	inline bool loadScene(const std::string& path, Scene* scene, std::string* outError) {
+		std::ifstream file(path);
+		if (!file) {
+			*outError = "cannot open " + path;
+			return false;
+		}
+
+		Shape* shape = nullptr;
+
+		// Placement of the current shape, the pipeline gets it reversed
+		std::vector<Transform*> placement;
+		auto finishShape = [&]() {
+			for (auto it = placement.rbegin(); it != placement.rend(); it++) shape->pushTransform(*it);
+			placement.clear();
+		};
+
+		std::string line;
+
+		for (unsigned int lineNumber = 1; std::getline(file, line); lineNumber++) {
+			line = line.substr(0, line.find('#'));
+
+			std::istringstream tokens(line);
+			std::string command;
+			if (!(tokens >> command)) continue;
+
+			float v[3];
+			if (!(tokens >> v[0] >> v[1] >> v[2])) {
+				*outError = path + ":" + std::to_string(lineNumber) + ": expected three numbers after " + command;
+				return false;
+			}
+			sf::Vector3f vector(v[0], v[1], v[2]);
+			Color color((sf::Uint8)v[0], (sf::Uint8)v[1], (sf::Uint8)v[2]);
+
+			if (command == "sky") {
+				scene->setSkyColor(color);
+			}
+			else if (command == "light") {
+				GlobalLight light = scene->getGlobalLight();
+				light.direction = vector;
+				scene->setGlobalLight(light);
+			}
+			else if (command == "sphere" || command == "box") {
+				if (shape) finishShape();
+
+				shape = command == "sphere" ? Sphere() : Box();
+				shape->color = color;
+				scene->mountShape(shape);
+			}
+			else if (shape && command == "translate") {
+				placement.push_back(new Translate(-vector));
+			}
+			else if (shape && command == "rotate") {
+				auto rotate = new Rotate();
+				rotate->eulerAngles = sf::Vector3f(degToRad(v[0]), degToRad(v[1]), degToRad(v[2]));
+				rotate->inverse = true;
+				placement.push_back(rotate);
+			}
+			else if (shape && command == "scale") {
+				auto scale = new Scale();
+				scale->factor = vector;
+				placement.push_back(scale);
+			}
+			else {
+				for (Transform* transform : placement) delete transform;
+				*outError = path + ":" + std::to_string(lineNumber) + ": unexpected " + command;
+				return false;
+			}
+		}
+
+		if (shape) finishShape();
+
+		// Transforms were pushed after mountShape()
+		scene->invalidate();
+		return true;
+	}
+}
@@ -1,70 +1,318 @@
 #pragma once
 
-#include <SFML/Graphics.hpp>;
+#include <math.h>
+
+#include <algorithm>
+#include <limits>
+#include <memory>
+
+#include <SFML/System.hpp>;
 
 #include "Transform.hpp";
+#include "Detail.hpp"
+#include "Color.hpp"
+#include "Simd.hpp"
 
 namespace Manta {
 
+	inline float sphereDE(sf::Vector3f point);
+	inline float boxDE(sf::Vector3f point);
+	inline simd::vfloat sphereDESimd(simd::vfloat x, simd::vfloat y, simd::vfloat z);
+	inline simd::vfloat boxDESimd(simd::vfloat x, simd::vfloat y, simd::vfloat z);
+
+	// Distance functions bake() recognises. Baked shapes of these call
+	// them directly, so they inline into the loops over shapes instead of
+	// going through the pointer. Custom covers every other function and
+	// all shapes that aren't baked.
+	enum class Primitive {
+		Custom,
+		Sphere,
+		Box,
+		Field
+	};
+
+	// Distance function with state, for shapes a single function pointer
+	// can't describe. Copies of a shape share it, so it must not change
+	// once the shape is mounted.
+	class DistanceField {
+	public:
+		virtual ~DistanceField() {}
+
+		// Like Shape::distanceFunction. Where the distance is at least
+		// cutoff any lower bound of it that is at least cutoff as well may
+		// be returned instead, so fields can skip work that can't beat the
+		// best distance the caller already has.
+		virtual float distance(sf::Vector3f point, float cutoff) const = 0;
+	};
+
 	struct Shape {
 		float (*distanceFunction)(sf::Vector3f) {nullptr};
 
+		// Gradient of distanceFunction in the same space, any length. Shapes
+		// without one get their normals from four distance estimates.
+		sf::Vector3f (*gradientFunction)(sf::Vector3f) {nullptr};
+
+		// Evaluated instead of distanceFunction if set
+		std::shared_ptr<const DistanceField> field;
+
 		std::vector<std::shared_ptr<Transform>> pipeline;
 
-		float distanceEstimate(sf::Vector3f point) {
+		float distanceEstimate(sf::Vector3f point) const {
+			return distanceEstimate(point, std::numeric_limits<float>::infinity());
+		};
+
+		// Estimates of at least cutoff may come back as a lower bound that
+		// is at least cutoff too, see DistanceField. Shapes without a field
+		// always return the exact estimate. Custom functions and fields see
+		// the Detail footprint in their own space. point is taken by
+		// reference, scans over many shapes then pass the same one instead
+		// of packing it into registers anew for every shape.
+		float distanceEstimate(const sf::Vector3f& point, float cutoff) const {
+			if (baked) {
+				sf::Vector3f localPoint = bakedTransform.apply(point);
+
+				switch (primitive) {
+				case Primitive::Sphere: return sphereDE(localPoint) * bakedScale;
+				case Primitive::Box: return boxDE(localPoint) * bakedScale;
+				case Primitive::Field: {
+					Detail::Scope detail(1 / bakedScale);
+					return field->distance(localPoint, cutoff / bakedScale) * bakedScale;
+				}
+				default: {
+					Detail::Scope detail(1 / bakedScale);
+					return (*distanceFunction)(localPoint) * bakedScale;
+				}
+				}
+			}
+
 			sf::Vector3f processedPoint = point;
+			float stretch = 1;
 
 			for (uint8_t i = 0; i < pipeline.size(); i++) {
 				processedPoint = pipeline[i]->process(processedPoint);
+				stretch *= pipeline[i]->lipschitz();
 			}
 
-			return (*distanceFunction)(processedPoint);
+			Detail::Scope detail(stretch);
+			if (field) return field->distance(processedPoint, cutoff * stretch) / stretch;
+			return (*distanceFunction)(processedPoint) / stretch;
+		};
+
+		// Whether the shape has a vector distanceEstimate(), true for baked
+		// spheres and boxes
+		bool isVectorized() const {
+			return baked && (primitive == Primitive::Sphere || primitive == Primitive::Box);
+		};
+
+		// distanceEstimate() of simd::WIDTH points at once, only for shapes
+		// isVectorized() accepts. Every lane matches the scalar estimate.
+		simd::vfloat distanceEstimate(simd::vfloat x, simd::vfloat y, simd::vfloat z) const {
+			simd::vfloat localX, localY, localZ;
+			bakedTransform.apply(x, y, z, &localX, &localY, &localZ);
+
+			simd::vfloat distance = primitive == Primitive::Sphere ?
+				sphereDESimd(localX, localY, localZ) :
+				boxDESimd(localX, localY, localZ);
+
+			return simd::mul(distance, simd::set(bakedScale));
+		};
+
+		// Unit surface normal near point. Baked shapes with a gradient
+		// function take the analytic one through the transposed matrix,
+		// everything else samples the tetrahedron corners h away, four
+		// estimates instead of the six of central differences.
+		sf::Vector3f normal(sf::Vector3f point, float h) const {
+			sf::Vector3f gradient;
+
+			if (baked && gradientFunction) {
+				gradient = bakedTransform.applyTransposed((*gradientFunction)(bakedTransform.apply(point)));
+			}
+			else {
+				const sf::Vector3f CORNERS[4] = {
+					sf::Vector3f(1, -1, -1),
+					sf::Vector3f(-1, -1, 1),
+					sf::Vector3f(-1, 1, -1),
+					sf::Vector3f(1, 1, 1)
+				};
+
+				for (const sf::Vector3f& corner : CORNERS) gradient += corner * distanceEstimate(point + corner * h);
+			}
+
+			float length = sqrtf(gradient.x * gradient.x + gradient.y * gradient.y + gradient.z * gradient.z);
+			return length > 0 ? gradient / length : gradient;
 		};
 
 		void pushTransform(Transform* p) {
 			pipeline.push_back(std::shared_ptr<Transform>(p));
+			baked = false;
+		};
+
+		// Copies share their transforms, this gives the shape its own, so
+		// edits of the shape it was copied from no longer reach it
+		void clonePipeline() {
+			for (auto& transform : pipeline) transform = std::shared_ptr<Transform>(transform->clone());
 		};
 
-		sf::Color color;
+		// Collapses the pipeline into one matrix if every transform in it is
+		// affine. Has to be called again after a transform was changed.
+		// Returns false if the pipeline has to keep running as is.
+		bool bake() {
+			Affine combined = Affine::identity();
+
+			for (auto& transform : pipeline) {
+				Affine next;
+				if (!transform->toAffine(&next)) {
+					baked = false;
+					return false;
+				}
+				combined = combined.then(next);
+			}
+
+			bakedTransform = combined;
+			bakedScale = 1 / combined.maxStretch();
+			baked = true;
+
+			if (field) primitive = Primitive::Field;
+			else if (distanceFunction == sphereDE) primitive = Primitive::Sphere;
+			else if (distanceFunction == boxDE) primitive = Primitive::Box;
+			else primitive = Primitive::Custom;
+
+			return true;
+		};
+
+		bool isBaked() const {
+			return baked;
+		};
+
+		// Custom until bake() succeeded
+		Primitive getPrimitive() const {
+			return baked ? primitive : Primitive::Custom;
+		};
+
+		const Affine& getBakedTransform() const {
+			return bakedTransform;
+		};
+
+		// Factor applied to the local distance to get a safe world distance
+		float getBakedScale() const {
+			return bakedScale;
+		};
+
+		// World space bound, built by walking the pipeline backwards from
+		// the bound of the untransformed distance function.
+		Bounds getBounds() const {
+			Bounds bounds = localBounds;
+
+			for (size_t i = pipeline.size(); i > 0; i--) {
+				bounds = pipeline[i - 1]->transformBounds(bounds);
+			}
+
+			return bounds;
+		};
+
+		Color color;
+
+		// Bound of the surface in the space distanceFunction is evaluated in
+		Bounds localBounds = Bounds::infinite();
+
+	private:
+		bool baked = false;
+		Primitive primitive = Primitive::Custom;
+		Affine bakedTransform = Affine::identity();
+		float bakedScale = 1;
 	};
 
 
 	// Sphere
-	float sphereDE(sf::Vector3f point) {
-		return sqrt(powf(point.x, 2) +
-			powf(point.y, 2) +
-			powf(point.z, 2)) - 1;
+	inline float sphereDE(sf::Vector3f point) {
+		return sqrtf(point.x * point.x + point.y * point.y + point.z * point.z) - 1;
+	}
+
+	inline simd::vfloat sphereDESimd(simd::vfloat x, simd::vfloat y, simd::vfloat z) {
+		return simd::sub(simd::sqrt(simd::add(simd::add(simd::mul(x, x), simd::mul(y, y)), simd::mul(z, z))), simd::set(1));
+	}
+
+	sf::Vector3f sphereGradient(sf::Vector3f point) {
+		return point;
 	}
 
 	Shape* Sphere() {
 		Shape* s = new Shape();
 		s->distanceFunction = sphereDE;
+		s->gradientFunction = sphereGradient;
+		s->localBounds = Bounds::cube(1);
 		return s;
 	}
 
 	// Box
-	float boxDE(sf::Vector3f point) {
+	inline float boxDE(sf::Vector3f point) {
 		sf::Vector3f absP(
-			(float)abs(point.x) - 1,
-			(float)abs(point.y) - 1,
-			(float)abs(point.z) - 1
+			fabsf(point.x) - 1,
+			fabsf(point.y) - 1,
+			fabsf(point.z) - 1
 		);
 
+		// max(a, 0) as (a + |a|) / 2, which is exact and keeps compilers
+		// from branching around the squares below. fmaxf is a library call
+		// without fast math.
 		sf::Vector3f clampedP(
-			fmax(absP.x, 0),
-			fmax(absP.y, 0),
-			fmax(absP.z, 0)
+			(absP.x + fabsf(absP.x)) * .5f,
+			(absP.y + fabsf(absP.y)) * .5f,
+			(absP.z + fabsf(absP.z)) * .5f
 		);
 
 		return
-			(sqrt(powf(clampedP.x, 2) +
-				powf(clampedP.y, 2) +
-				powf(clampedP.z, 2))) + fmin(fmax(absP.x, fmax(absP.y, absP.z)), 0);
+			sqrtf(clampedP.x * clampedP.x + clampedP.y * clampedP.y + clampedP.z * clampedP.z) +
+			std::min(std::max(absP.x, std::max(absP.y, absP.z)), 0.f);
+	}
+
+	inline simd::vfloat boxDESimd(simd::vfloat x, simd::vfloat y, simd::vfloat z) {
+		const simd::vfloat one = simd::set(1);
+		const simd::vfloat zero = simd::set(0);
+
+		x = simd::sub(simd::abs(x), one);
+		y = simd::sub(simd::abs(y), one);
+		z = simd::sub(simd::abs(z), one);
+
+		simd::vfloat cx = simd::max(x, zero);
+		simd::vfloat cy = simd::max(y, zero);
+		simd::vfloat cz = simd::max(z, zero);
+
+		return simd::add(
+			simd::sqrt(simd::add(simd::add(simd::mul(cx, cx), simd::mul(cy, cy)), simd::mul(cz, cz))),
+			simd::min(simd::max(x, simd::max(y, z)), zero)
+		);
+	}
+
+	// Outside along the offset from the nearest point of the box, inside
+	// along the axis of the nearest face
+	sf::Vector3f boxGradient(sf::Vector3f point) {
+		sf::Vector3f absP(
+			fabsf(point.x) - 1,
+			fabsf(point.y) - 1,
+			fabsf(point.z) - 1
+		);
+
+		sf::Vector3f gradient;
+		if (absP.x > 0 || absP.y > 0 || absP.z > 0) {
+			gradient = sf::Vector3f(fmaxf(absP.x, 0), fmaxf(absP.y, 0), fmaxf(absP.z, 0));
+		}
+		else if (absP.x >= absP.y && absP.x >= absP.z) gradient.x = 1;
+		else if (absP.y >= absP.z) gradient.y = 1;
+		else gradient.z = 1;
+
+		return sf::Vector3f(
+			copysignf(gradient.x, point.x),
+			copysignf(gradient.y, point.y),
+			copysignf(gradient.z, point.z)
+		);
 	}
 
 	Shape* Box() {
 		Shape* s = new Shape();
 		s->distanceFunction = boxDE;
+		s->gradientFunction = boxGradient;
+		s->localBounds = Bounds::cube(1);
 		return s;
 	}
 }
\ No newline at end of file
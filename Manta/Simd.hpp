@@ -0,0 +1,215 @@
+#pragma once
+
+// Thin wrapper over the widest float vector the compiler targets. With
+// MSVC that means /arch:AVX2 or /arch:AVX512, otherwise x64 builds use
+// SSE2 and everything else falls back to plain floats. loadBytes(),
+// loadShorts() and storeBytes() move WIDTH unsigned 8 / 16 bit values in
+// and out of a vector, storeBytes() truncates and saturates to [0, 255].
+// expandRGB() turns packed RGB bytes into RGBA.
+
+#if defined(__AVX512F__)
+#define MANTA_SIMD_AVX512
+#include <immintrin.h>
+#elif defined(__AVX2__) || defined(__AVX__)
+#define MANTA_SIMD_AVX
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MANTA_SIMD_SSE
+#include <emmintrin.h>
+#endif
+
+#include <math.h>
+#include <string.h>
+
+namespace Manta {
+	namespace simd {
+
+#if defined(MANTA_SIMD_AVX512)
+
+		const unsigned int WIDTH = 16;
+
+		typedef __m512 vfloat;
+		typedef __mmask16 vmask;
+
+		inline vfloat set(float v) { return _mm512_set1_ps(v); }
+		inline vfloat load(const float* p) { return _mm512_loadu_ps(p); }
+		inline void store(float* p, vfloat v) { _mm512_storeu_ps(p, v); }
+
+		inline vfloat add(vfloat a, vfloat b) { return _mm512_add_ps(a, b); }
+		inline vfloat sub(vfloat a, vfloat b) { return _mm512_sub_ps(a, b); }
+		inline vfloat mul(vfloat a, vfloat b) { return _mm512_mul_ps(a, b); }
+		inline vfloat min(vfloat a, vfloat b) { return _mm512_min_ps(a, b); }
+		inline vfloat max(vfloat a, vfloat b) { return _mm512_max_ps(a, b); }
+		inline vfloat sqrt(vfloat a) { return _mm512_sqrt_ps(a); }
+		inline vfloat abs(vfloat a) { return _mm512_abs_ps(a); }
+
+		inline vmask lessThan(vfloat a, vfloat b) { return _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ); }
+		inline vmask lessEqual(vfloat a, vfloat b) { return _mm512_cmp_ps_mask(a, b, _CMP_LE_OQ); }
+		inline vmask greaterEqual(vfloat a, vfloat b) { return _mm512_cmp_ps_mask(a, b, _CMP_GE_OQ); }
+		inline vmask equal(vfloat a, vfloat b) { return _mm512_cmp_ps_mask(a, b, _CMP_EQ_OQ); }
+
+		// mask ? b : a
+		inline vfloat select(vmask mask, vfloat a, vfloat b) { return _mm512_mask_blend_ps(mask, a, b); }
+		inline vmask both(vmask a, vmask b) { return a & b; }
+		inline unsigned int bits(vmask mask) { return (unsigned int)mask; }
+
+		inline vfloat loadBytes(const unsigned char* p) { return _mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i*)p))); }
+		inline vfloat loadShorts(const unsigned short* p) { return _mm512_cvtepi32_ps(_mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i*)p))); }
+		inline void storeBytes(unsigned char* p, vfloat v) {
+			__m512i i = _mm512_max_epi32(_mm512_cvttps_epi32(v), _mm512_setzero_si512());
+			_mm_storeu_si128((__m128i*)p, _mm512_cvtusepi32_epi8(i));
+		}
+
+#elif defined(MANTA_SIMD_AVX)
+
+		const unsigned int WIDTH = 8;
+
+		typedef __m256 vfloat;
+		typedef __m256 vmask;
+
+		inline vfloat set(float v) { return _mm256_set1_ps(v); }
+		inline vfloat load(const float* p) { return _mm256_loadu_ps(p); }
+		inline void store(float* p, vfloat v) { _mm256_storeu_ps(p, v); }
+
+		inline vfloat add(vfloat a, vfloat b) { return _mm256_add_ps(a, b); }
+		inline vfloat sub(vfloat a, vfloat b) { return _mm256_sub_ps(a, b); }
+		inline vfloat mul(vfloat a, vfloat b) { return _mm256_mul_ps(a, b); }
+		inline vfloat min(vfloat a, vfloat b) { return _mm256_min_ps(a, b); }
+		inline vfloat max(vfloat a, vfloat b) { return _mm256_max_ps(a, b); }
+		inline vfloat sqrt(vfloat a) { return _mm256_sqrt_ps(a); }
+		inline vfloat abs(vfloat a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.f), a); }
+
+		inline vmask lessThan(vfloat a, vfloat b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+		inline vmask lessEqual(vfloat a, vfloat b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+		inline vmask greaterEqual(vfloat a, vfloat b) { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+		inline vmask equal(vfloat a, vfloat b) { return _mm256_cmp_ps(a, b, _CMP_EQ_OQ); }
+
+		inline vfloat select(vmask mask, vfloat a, vfloat b) { return _mm256_blendv_ps(a, b, mask); }
+		inline vmask both(vmask a, vmask b) { return _mm256_and_ps(a, b); }
+		inline unsigned int bits(vmask mask) { return (unsigned int)_mm256_movemask_ps(mask); }
+
+		// Integer conversions in two SSE halves, plain AVX has no 256 bit
+		// integer instructions
+		inline vfloat loadBytes(const unsigned char* p) {
+			__m128i b = _mm_loadl_epi64((const __m128i*)p);
+			__m256i i = _mm256_insertf128_si256(_mm256_castsi128_si256(_mm_cvtepu8_epi32(b)), _mm_cvtepu8_epi32(_mm_srli_si128(b, 4)), 1);
+			return _mm256_cvtepi32_ps(i);
+		}
+		inline vfloat loadShorts(const unsigned short* p) {
+			__m128i s = _mm_loadu_si128((const __m128i*)p);
+			__m256i i = _mm256_insertf128_si256(_mm256_castsi128_si256(_mm_cvtepu16_epi32(s)), _mm_cvtepu16_epi32(_mm_srli_si128(s, 8)), 1);
+			return _mm256_cvtepi32_ps(i);
+		}
+		inline void storeBytes(unsigned char* p, vfloat v) {
+			__m256i i = _mm256_cvttps_epi32(v);
+			__m128i s = _mm_packs_epi32(_mm256_castsi256_si128(i), _mm256_extractf128_si256(i, 1));
+			_mm_storel_epi64((__m128i*)p, _mm_packus_epi16(s, s));
+		}
+
+#elif defined(MANTA_SIMD_SSE)
+
+		const unsigned int WIDTH = 4;
+
+		typedef __m128 vfloat;
+		typedef __m128 vmask;
+
+		inline vfloat set(float v) { return _mm_set1_ps(v); }
+		inline vfloat load(const float* p) { return _mm_loadu_ps(p); }
+		inline void store(float* p, vfloat v) { _mm_storeu_ps(p, v); }
+
+		inline vfloat add(vfloat a, vfloat b) { return _mm_add_ps(a, b); }
+		inline vfloat sub(vfloat a, vfloat b) { return _mm_sub_ps(a, b); }
+		inline vfloat mul(vfloat a, vfloat b) { return _mm_mul_ps(a, b); }
+		inline vfloat min(vfloat a, vfloat b) { return _mm_min_ps(a, b); }
+		inline vfloat max(vfloat a, vfloat b) { return _mm_max_ps(a, b); }
+		inline vfloat sqrt(vfloat a) { return _mm_sqrt_ps(a); }
+		inline vfloat abs(vfloat a) { return _mm_andnot_ps(_mm_set1_ps(-0.f), a); }
+
+		inline vmask lessThan(vfloat a, vfloat b) { return _mm_cmplt_ps(a, b); }
+		inline vmask lessEqual(vfloat a, vfloat b) { return _mm_cmple_ps(a, b); }
+		inline vmask greaterEqual(vfloat a, vfloat b) { return _mm_cmpge_ps(a, b); }
+		inline vmask equal(vfloat a, vfloat b) { return _mm_cmpeq_ps(a, b); }
+
+		// SSE2 has no blendv, and/andnot/or does the same
+		inline vfloat select(vmask mask, vfloat a, vfloat b) { return _mm_or_ps(_mm_and_ps(mask, b), _mm_andnot_ps(mask, a)); }
+		inline vmask both(vmask a, vmask b) { return _mm_and_ps(a, b); }
+		inline unsigned int bits(vmask mask) { return (unsigned int)_mm_movemask_ps(mask); }
+
+		inline vfloat loadBytes(const unsigned char* p) {
+			int word;
+			memcpy(&word, p, 4);
+			__m128i b = _mm_unpacklo_epi8(_mm_cvtsi32_si128(word), _mm_setzero_si128());
+			return _mm_cvtepi32_ps(_mm_unpacklo_epi16(b, _mm_setzero_si128()));
+		}
+		inline vfloat loadShorts(const unsigned short* p) {
+			return _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i*)p), _mm_setzero_si128()));
+		}
+		inline void storeBytes(unsigned char* p, vfloat v) {
+			__m128i s = _mm_packs_epi32(_mm_cvttps_epi32(v), _mm_setzero_si128());
+			int word = _mm_cvtsi128_si32(_mm_packus_epi16(s, s));
+			memcpy(p, &word, 4);
+		}
+
+#else
+
+		const unsigned int WIDTH = 1;
+
+		typedef float vfloat;
+		typedef bool vmask;
+
+		inline vfloat set(float v) { return v; }
+		inline vfloat load(const float* p) { return *p; }
+		inline void store(float* p, vfloat v) { *p = v; }
+
+		inline vfloat add(vfloat a, vfloat b) { return a + b; }
+		inline vfloat sub(vfloat a, vfloat b) { return a - b; }
+		inline vfloat mul(vfloat a, vfloat b) { return a * b; }
+		inline vfloat min(vfloat a, vfloat b) { return a < b ? a : b; }
+		inline vfloat max(vfloat a, vfloat b) { return a > b ? a : b; }
+		inline vfloat sqrt(vfloat a) { return sqrtf(a); }
+		inline vfloat abs(vfloat a) { return fabsf(a); }
+
+		inline vmask lessThan(vfloat a, vfloat b) { return a < b; }
+		inline vmask lessEqual(vfloat a, vfloat b) { return a <= b; }
+		inline vmask greaterEqual(vfloat a, vfloat b) { return a >= b; }
+		inline vmask equal(vfloat a, vfloat b) { return a == b; }
+
+		inline vfloat select(vmask mask, vfloat a, vfloat b) { return mask ? b : a; }
+		inline vmask both(vmask a, vmask b) { return a && b; }
+		inline unsigned int bits(vmask mask) { return mask ? 1 : 0; }
+
+		inline vfloat loadBytes(const unsigned char* p) { return (float)*p; }
+		inline vfloat loadShorts(const unsigned short* p) { return (float)*p; }
+		inline void storeBytes(unsigned char* p, vfloat v) { *p = (unsigned char)(v < 0 ? 0 : v > 255 ? 255 : v); }
+
+#endif
+
+		// Spreads pixels RGB triplets to RGBA with alpha 255
+		inline void expandRGB(const unsigned char* rgb, unsigned char* rgba, unsigned int pixels) {
+			unsigned int p = 0;
+
+#if defined(MANTA_SIMD_AVX512) || defined(MANTA_SIMD_AVX)
+			// Four pixels per shuffle, the 16 byte loads stop before they
+			// could read past the end
+			const __m128i order = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+			const __m128i alpha = _mm_set1_epi32((int)0xff000000);
+
+			for (; p + 6 <= pixels; p += 4) {
+				__m128i v = _mm_loadu_si128((const __m128i*)&rgb[p * 3]);
+				_mm_storeu_si128((__m128i*)&rgba[p * 4], _mm_or_si128(_mm_shuffle_epi8(v, order), alpha));
+			}
+#endif
+
+			for (; p < pixels; p++) {
+				unsigned char pixel[4] = { rgb[p * 3], rgb[p * 3 + 1], rgb[p * 3 + 2], 255 };
+				memcpy(&rgba[p * 4], pixel, 4);
+			}
+		}
+
+		// Number of floats to allocate for count lanes so every vector
+		// load stays in bounds
+		constexpr unsigned int padded(unsigned int count) {
+			return ((count + WIDTH - 1) / WIDTH) * WIDTH;
+		}
+	}
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <atomic>
+
+#include <SFML/System.hpp>
+
+namespace Manta {
+
+	// Opt-in debug capture of march steps. While enabled every Ray and
+	// LightRay appends its positions to a fixed size ring owned by the
+	// calling thread, so the oldest steps get overwritten instead of
+	// anything being allocated. Disabled it costs one relaxed load per step.
+	class StepTrace {
+	public:
+		static const unsigned int CAPACITY = 4096;
+
+		struct Step {
+			sf::Vector3f position;
+			float sceneIndex;
+
+			// Set on the first step recorded by a new ray
+			bool rayStart;
+		};
+
+		static void setEnabled(bool enabled) {
+			enabledFlag().store(enabled, std::memory_order_relaxed);
+		}
+
+		static bool isEnabled() {
+			return enabledFlag().load(std::memory_order_relaxed);
+		}
+
+		// Ring of the calling thread
+		static StepTrace& local() {
+			thread_local StepTrace trace;
+			return trace;
+		}
+
+		void record(sf::Vector3f position, float sceneIndex, bool rayStart) {
+			this->head = (this->head + 1) % CAPACITY;
+			this->steps[this->head] = Step{ position, sceneIndex, rayStart };
+			if (this->count < CAPACITY) this->count++;
+		}
+
+		void clear() {
+			this->count = 0;
+		}
+
+		unsigned int size() {
+			return this->count;
+		}
+
+		// 0 is the most recent step
+		const Step& get(unsigned int i) {
+			return this->steps[(this->head + CAPACITY - i) % CAPACITY];
+		}
+
+	private:
+		Step steps[CAPACITY];
+		unsigned int head = 0;
+		unsigned int count = 0;
+
+		static std::atomic<bool>& enabledFlag() {
+			static std::atomic<bool> flag(false);
+			return flag;
+		}
+	};
+}
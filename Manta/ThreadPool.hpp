@@ -0,0 +1,190 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Manta {
+
+	// Persistent workers with one task deque each. A worker takes its own
+	// tasks from the back and, once it runs dry, steals from the front of
+	// the others, so uneven work spreads out without a central queue.
+	class ThreadPool {
+	public:
+
+		// Runs task(0) ... task(count - 1) on the workers and returns once
+		// all of them finished. Consecutive indices start out on the same
+		// worker to keep neighbouring tiles together. Tasks may call it
+		// again, the calling worker then helps with the queued tasks.
+		void parallelFor(unsigned int count, const std::function<void(unsigned int)>& task) {
+			if (count == 0) return;
+
+			Batch batch;
+			batch.pending = count;
+
+			// Counted before they are queued, so no worker sees more tasks
+			// taken than queued
+			this->queued += count;
+
+			unsigned int nWorkers = (unsigned int)this->workers.size();
+			for (unsigned int w = 0; w < nWorkers; w++) {
+				unsigned int begin = (unsigned int)((unsigned long long)count * w / nWorkers);
+				unsigned int end = (unsigned int)((unsigned long long)count * (w + 1) / nWorkers);
+
+				std::lock_guard<std::mutex> lock(this->workers[w]->mutex);
+				for (unsigned int i = begin; i < end; i++) {
+					this->workers[w]->tasks.push_back(Task{ &batch, &task, i });
+				}
+			}
+
+			// Workers check queued with sleepMutex held, so one about to
+			// sleep has either seen the tasks or gets the notification
+			{
+				std::lock_guard<std::mutex> lock(this->sleepMutex);
+			}
+			this->wake.notify_all();
+
+			// A worker blocked here would hold back the tasks queued on it
+			int self = currentWorker();
+			if (self >= 0 && workerPool() == this) {
+				Task next;
+				while (batch.pending.load() > 0 && this->take((unsigned int)self, &next)) this->run(next);
+			}
+
+			std::unique_lock<std::mutex> lock(batch.mutex);
+			batch.done.wait(lock, [&batch]() { return batch.finished; });
+		}
+
+		unsigned int size() {
+			return (unsigned int)this->workers.size();
+		}
+
+		// Index of the calling worker, -1 outside of the pool
+		static int currentWorker() {
+			return workerIndex();
+		}
+
+		// nThreads = 0 uses one worker per hardware thread
+		ThreadPool(unsigned int nThreads = 0) {
+			if (nThreads == 0) nThreads = std::thread::hardware_concurrency();
+			if (nThreads == 0) nThreads = 1;
+
+			for (unsigned int i = 0; i < nThreads; i++) {
+				this->workers.push_back(std::unique_ptr<Worker>(new Worker()));
+			}
+			for (unsigned int i = 0; i < nThreads; i++) {
+				this->workers[i]->thread = std::thread(&ThreadPool::work, this, i);
+			}
+		}
+
+		~ThreadPool() {
+			{
+				std::lock_guard<std::mutex> lock(this->sleepMutex);
+				this->stopping = true;
+			}
+			this->wake.notify_all();
+
+			for (auto& worker : this->workers) worker->thread.join();
+		}
+
+	private:
+		// finished is set under mutex by the last task, once the caller
+		// sees it no worker touches the batch again
+		struct Batch {
+			std::atomic<unsigned int> pending{ 0 };
+			bool finished = false;
+			std::mutex mutex;
+			std::condition_variable done;
+		};
+
+		struct Task {
+			Batch* batch;
+			const std::function<void(unsigned int)>* function;
+			unsigned int index;
+		};
+
+		struct Worker {
+			std::deque<Task> tasks;
+			std::mutex mutex;
+			std::thread thread;
+		};
+
+		std::vector<std::unique_ptr<Worker>> workers;
+
+		// Tasks not yet taken by any worker
+		std::atomic<unsigned int> queued{ 0 };
+
+		// Guarded by sleepMutex, which is only taken to sleep and wake
+		bool stopping = false;
+
+		std::mutex sleepMutex;
+		std::condition_variable wake;
+
+		static int& workerIndex() {
+			thread_local int index = -1;
+			return index;
+		}
+
+		static ThreadPool*& workerPool() {
+			thread_local ThreadPool* pool = nullptr;
+			return pool;
+		}
+
+		bool take(unsigned int self, Task* out) {
+			{
+				Worker* own = this->workers[self].get();
+				std::lock_guard<std::mutex> lock(own->mutex);
+				if (!own->tasks.empty()) {
+					*out = own->tasks.back();
+					own->tasks.pop_back();
+					this->queued--;
+					return true;
+				}
+			}
+
+			for (unsigned int i = 1; i < this->workers.size(); i++) {
+				Worker* victim = this->workers[(self + i) % this->workers.size()].get();
+				std::lock_guard<std::mutex> lock(victim->mutex);
+				if (!victim->tasks.empty()) {
+					*out = victim->tasks.front();
+					victim->tasks.pop_front();
+					this->queued--;
+					return true;
+				}
+			}
+
+			return false;
+		}
+
+		void run(const Task& task) {
+			(*task.function)(task.index);
+
+			if (--task.batch->pending == 0) {
+				std::lock_guard<std::mutex> lock(task.batch->mutex);
+				task.batch->finished = true;
+				task.batch->done.notify_all();
+			}
+		}
+
+		void work(unsigned int self) {
+			workerIndex() = (int)self;
+			workerPool() = this;
+
+			while (true) {
+				{
+					std::unique_lock<std::mutex> lock(this->sleepMutex);
+					this->wake.wait(lock, [this]() { return this->stopping || this->queued > 0; });
+					if (this->stopping) return;
+				}
+
+				Task task;
+				while (this->take(self, &task)) this->run(task);
+			}
+		}
+	};
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include <SFML/System.hpp>
+
+namespace Manta {
+
+	// Finished pixels handed from render workers to the thread presenting
+	// them. Workers push their own copy of a rectangle, the presenter takes
+	// everything pushed so far with one exchange, so no buffer is ever
+	// shared and neither side waits for the other.
+	class TileQueue {
+	public:
+		struct Patch {
+			unsigned int x;
+			unsigned int y;
+			unsigned int width;
+			unsigned int height;
+
+			// RGBA rows of the rectangle
+			std::vector<sf::Uint8> pixels;
+
+			// Cost channels per pixel, empty unless the cost pass exists and
+			// RenderStats was enabled
+			std::vector<float> cost;
+
+			Patch* next = nullptr;
+		};
+
+		// Takes ownership of patch, safe from any number of threads
+		void push(Patch* patch) {
+			patch->next = this->head.load(std::memory_order_relaxed);
+			while (!this->head.compare_exchange_weak(patch->next, patch, std::memory_order_release, std::memory_order_relaxed));
+		}
+
+		// Everything pushed since the last call, oldest first
+		std::vector<std::unique_ptr<Patch>> takeAll() {
+			Patch* patch = this->head.exchange(nullptr, std::memory_order_acquire);
+
+			std::vector<std::unique_ptr<Patch>> patches;
+			for (; patch; patch = patch->next) patches.emplace_back(patch);
+
+			// The stack hands them out newest first
+			std::reverse(patches.begin(), patches.end());
+			return patches;
+		}
+
+		TileQueue() = default;
+		TileQueue(const TileQueue&) = delete;
+		TileQueue& operator=(const TileQueue&) = delete;
+
+		~TileQueue() {
+			this->takeAll();
+		}
+
+	private:
+		std::atomic<Patch*> head{ nullptr };
+	};
+}
@@ -1,13 +1,42 @@
 #pragma once
 
-#include <SFML/Graphics.hpp>;
+#include <limits>
+
+#include <SFML/System.hpp>;
 #include "Rotation.hpp";
+#include "Bounds.hpp"
+#include "Affine.hpp"
 
 namespace Manta {
 
 	class Transform {
 	public:
+		virtual ~Transform() {}
+
 		virtual sf::Vector3f process(sf::Vector3f point) = 0;
+
+		// Copy that can be edited without affecting this one
+		virtual Transform* clone() = 0;
+
+		// Maps a bound given in the space after this transform back into the
+		// space before it. Transforms that cannot bound their inverse keep
+		// the default, which disables culling for the owning shape.
+		virtual Bounds transformBounds(const Bounds&) {
+			return Bounds::infinite();
+		}
+
+		// Writes the transform as a matrix if it is affine. Shapes whose
+		// whole pipeline can be expressed this way get baked into a single
+		// matrix, everything else keeps calling process().
+		virtual bool toAffine(Affine*) {
+			return false;
+		}
+
+		// Upper bound of how much process() stretches distances. Distances
+		// measured after the transform are divided by it to stay safe.
+		virtual float lipschitz() {
+			return 1;
+		}
 	};
 
 
@@ -19,6 +48,22 @@ namespace Manta {
 			return point + deltaPosition;
 		};
 
+		Bounds transformBounds(const Bounds& bounds) override {
+			return Bounds{ bounds.min - deltaPosition, bounds.max - deltaPosition };
+		};
+
+		bool toAffine(Affine* out) override {
+			*out = Affine::identity();
+			out->m[3] = deltaPosition.x;
+			out->m[7] = deltaPosition.y;
+			out->m[11] = deltaPosition.z;
+			return true;
+		};
+
+		Transform* clone() override {
+			return new Translate(*this);
+		};
+
 		Translate(sf::Vector3f deltaPosition) {
 			this->deltaPosition = deltaPosition;
 		};
@@ -28,11 +73,55 @@ namespace Manta {
 	public:
 		sf::Vector3f eulerAngles;
 
+		// Undoes the rotation by eulerAngles instead, so the shape after it
+		// turns by them
+		bool inverse = false;
+
 		sf::Vector3f process(const sf::Vector3f point) override {
+			return this->inverse ? this->backward(point) : this->forward(point);
+		};
+
+		Bounds transformBounds(const Bounds& bounds) override {
+			if (bounds.isInfinite()) return bounds;
+
+			Bounds result = Bounds::empty();
+			for (unsigned int i = 0; i < 8; i++) {
+				sf::Vector3f corner = bounds.corner(i);
+				result.extend(this->inverse ? this->forward(corner) : this->backward(corner));
+			}
+			return result;
+		};
+
+		// The rotation is linear, so its columns are the rotated axes
+		bool toAffine(Affine* out) override {
+			sf::Vector3f x = this->process(sf::Vector3f(1, 0, 0));
+			sf::Vector3f y = this->process(sf::Vector3f(0, 1, 0));
+			sf::Vector3f z = this->process(sf::Vector3f(0, 0, 1));
+
+			*out = Affine{ {
+				x.x, y.x, z.x, 0,
+				x.y, y.y, z.y, 0,
+				x.z, y.z, z.z, 0
+			} };
+			return true;
+		};
+
+		Transform* clone() override {
+			return new Rotate(*this);
+		};
+
+	private:
+		// X, Z, then Y
+		sf::Vector3f forward(sf::Vector3f point) {
 			sf::Vector3f p = rotateX(&point, this->eulerAngles.x);
 			p = rotateZ(&p, this->eulerAngles.z);
-			p = rotateY(&p, this->eulerAngles.y);
-			return p;
+			return rotateY(&p, this->eulerAngles.y);
+		};
+
+		sf::Vector3f backward(sf::Vector3f point) {
+			sf::Vector3f p = rotateY(&point, -this->eulerAngles.y);
+			p = rotateZ(&p, -this->eulerAngles.z);
+			return rotateX(&p, -this->eulerAngles.x);
 		};
 	};
 
@@ -47,6 +136,141 @@ namespace Manta {
 				point.z / this->factor.z
 			);
 		}
+
+		Bounds transformBounds(const Bounds& bounds) override {
+			Bounds result = Bounds::empty();
+			result.extend(sf::Vector3f(bounds.min.x * this->factor.x, bounds.min.y * this->factor.y, bounds.min.z * this->factor.z));
+			result.extend(sf::Vector3f(bounds.max.x * this->factor.x, bounds.max.y * this->factor.y, bounds.max.z * this->factor.z));
+			return result;
+		}
+
+		bool toAffine(Affine* out) override {
+			*out = Affine{ {
+				1 / this->factor.x, 0, 0, 0,
+				0, 1 / this->factor.y, 0, 0,
+				0, 0, 1 / this->factor.z, 0
+			} };
+			return true;
+		}
+
+		// Dividing by the smallest factor stretches the most
+		float lipschitz() override {
+			return 1 / fminf(fabsf(this->factor.x), fminf(fabsf(this->factor.y), fabsf(this->factor.z)));
+		}
+
+		Transform* clone() override {
+			return new Scale(*this);
+		}
+	};
+
+	// Folds space into cells of period along every axis with a period
+	// above 0, so the shape after it repeats with the centre cell around
+	// the origin. Axes with a limit of 0 or more stop limit cells away
+	// from the centre one, the others repeat forever. Only the nearest
+	// cell is evaluated, which is exact for shapes symmetric about the
+	// cell centre that stay inside half a period of it.
+	class Repeat : public Transform {
+	public:
+		sf::Vector3f period;
+		sf::Vector3i limit = sf::Vector3i(-1, -1, -1);
+
+		sf::Vector3f process(const sf::Vector3f point) override {
+			return sf::Vector3f(
+				fold(point.x, this->period.x, this->limit.x),
+				fold(point.y, this->period.y, this->limit.y),
+				fold(point.z, this->period.z, this->limit.z)
+			);
+		}
+
+		Bounds transformBounds(const Bounds& bounds) override {
+			Bounds result = bounds;
+			extendAxis(&result.min.x, &result.max.x, this->period.x, this->limit.x);
+			extendAxis(&result.min.y, &result.max.y, this->period.y, this->limit.y);
+			extendAxis(&result.min.z, &result.max.z, this->period.z, this->limit.z);
+			return result;
+		}
+
+		Transform* clone() override {
+			return new Repeat(*this);
+		}
+
+		Repeat(sf::Vector3f period) {
+			this->period = period;
+		};
+
+		Repeat(sf::Vector3f period, sf::Vector3i limit) {
+			this->period = period;
+			this->limit = limit;
+		};
+
+	private:
+		static float fold(float x, float period, int limit) {
+			if (period <= 0) return x;
+
+			float cell = roundf(x / period);
+			if (limit >= 0) cell = fminf(fmaxf(cell, (float)-limit), (float)limit);
+
+			return x - period * cell;
+		}
+
+		static void extendAxis(float* min, float* max, float period, int limit) {
+			if (period <= 0) return;
+
+			if (limit < 0) {
+				*min = -std::numeric_limits<float>::infinity();
+				*max = std::numeric_limits<float>::infinity();
+				return;
+			}
+
+			*min -= period * limit;
+			*max += period * limit;
+		}
+	};
+
+	// Folds space around the x axis into count equal sectors, so the shape
+	// after it repeats around the axis. The sector evaluated is the one
+	// centred on +y, shapes have to stay inside it and be symmetric about
+	// its centre plane to be exact.
+	class RadialRepeat : public Transform {
+	public:
+		// At least 1
+		unsigned int count;
+
+		sf::Vector3f process(const sf::Vector3f point) override {
+			float sector = (float)(2 * M_PI) / this->count;
+
+			float angle = atan2f(point.z, point.y);
+			angle -= sector * roundf(angle / sector);
+
+			float radius = sqrtf(point.y * point.y + point.z * point.z);
+			return sf::Vector3f(point.x, radius * cosf(angle), radius * sinf(angle));
+		}
+
+		// A sector can be turned to any angle, the bound is the cylinder
+		// around the axis through the farthest corner
+		Bounds transformBounds(const Bounds& bounds) override {
+			if (bounds.isInfinite()) return Bounds::infinite();
+
+			float radius = 0;
+			for (unsigned int i = 0; i < 8; i++) {
+				sf::Vector3f corner = bounds.corner(i);
+				radius = fmaxf(radius, sqrtf(corner.y * corner.y + corner.z * corner.z));
+			}
+
+			return Bounds{
+				sf::Vector3f(bounds.min.x, -radius, -radius),
+				sf::Vector3f(bounds.max.x, radius, radius)
+			};
+		}
+
+		Transform* clone() override {
+			return new RadialRepeat(*this);
+		}
+
+		// A count of 0 has no sectors, it repeats once like 1
+		RadialRepeat(unsigned int count) {
+			this->count = count > 0 ? count : 1;
+		};
 	};
 
 };
\ No newline at end of file
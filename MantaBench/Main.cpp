@@ -0,0 +1,805 @@
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <functional>
+#include <chrono>
+#include <cstring>
+#include <random>
+#include <sstream>
+#include <string>
+
+#include <SFML/System.hpp>
+
+#include "../Manta/Shape.hpp"
+#include "../Manta/Transform.hpp"
+#include "../Manta/CSG.hpp"
+#include "../Manta/Instances.hpp"
+#include "../Manta/Scene.hpp"
+#include "../Manta/Camera.hpp"
+#include "../Manta/Scenes.hpp"
+#include "../Manta/RenderStats.hpp"
+
+// Seeded random scene of spheres and boxes. The volume grows with the
+// shape count so the density, and with it the expected nearest distance,
+// stays comparable across sizes.
+void buildScene(Manta::Scene* scene, unsigned int count, std::mt19937* rng) {
+	float extent = 10 * cbrtf(count / 20.f);
+	std::uniform_real_distribution<float> position(-extent, extent);
+
+	for (unsigned int i = 0; i < count; i++) {
+		auto shape = (*rng)() % 2 == 0 ? Manta::Sphere() : Manta::Box();
+		shape->color = Manta::Color((*rng)() % 255, (*rng)() % 255, (*rng)() % 255);
+		shape->pushTransform(new Manta::Translate(sf::Vector3f(position(*rng), position(*rng), position(*rng))));
+
+		scene->mountShape(shape);
+	}
+}
+
+// Average nanoseconds per query over all points, outDistances is optional
+double timeQueries(
+	Manta::Scene* scene,
+	const std::vector<sf::Vector3f>& points,
+	std::vector<unsigned int>* outClosest,
+	std::vector<float>* outDistances = nullptr
+) {
+	std::shared_ptr<const Manta::SceneSnapshot> snapshot = scene->prepare();
+	const Manta::Shape* closest = nullptr;
+	unsigned int closestIndex = 0;
+
+	outClosest->resize(points.size());
+	if (outDistances) outDistances->resize(points.size());
+
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < points.size(); i++) {
+		float distance = snapshot->sceneIndex(points[i], &closest, &closestIndex);
+		(*outClosest)[i] = closestIndex;
+		if (outDistances) (*outDistances)[i] = distance;
+	}
+	auto end = std::chrono::steady_clock::now();
+
+	return std::chrono::duration<double, std::nano>(end - start).count() / points.size();
+}
+
+// Keeps the passes in memory, nothing is presented
+class BenchRenderHandler : public Manta::MultipassRenderHandler {
+public:
+	void onStart() override {}
+	void onFinish() override {}
+
+	BenchRenderHandler(Manta::CameraData* cameraData, const Manta::PassRegistry& registry = Manta::PassRegistry::defaults()) :
+		MultipassRenderHandler(cameraData, registry) {}
+};
+
+// Linear scan against the acceleration structures for growing shape counts
+void benchSceneIndex() {
+	const unsigned int SHAPE_COUNTS[] = { 20, 100, 1000, 10000, 100000 };
+	const unsigned int NUM_QUERIES = 2000;
+
+	std::cout << std::setw(10) << "shapes"
+		<< std::setw(16) << "linear ns/q"
+		<< std::setw(16) << "bvh ns/q"
+		<< std::setw(16) << "compiled ns/q"
+		<< std::setw(12) << "mismatch" << std::endl;
+
+	for (unsigned int count : SHAPE_COUNTS) {
+		std::mt19937 rng(1234);
+
+		Manta::Scene scene;
+		buildScene(&scene, count, &rng);
+
+		float extent = 10 * cbrtf(count / 20.f);
+		std::uniform_real_distribution<float> position(-extent, extent);
+
+		std::vector<sf::Vector3f> points(NUM_QUERIES);
+		for (auto& p : points) p = sf::Vector3f(position(rng), position(rng), position(rng));
+
+		std::vector<unsigned int> linearClosest, bvhClosest, compiledClosest;
+
+		scene.setAcceleration(Manta::Acceleration::None);
+		double linear = timeQueries(&scene, points, &linearClosest);
+
+		scene.setAcceleration(Manta::Acceleration::BVH);
+		double bvh = timeQueries(&scene, points, &bvhClosest);
+
+		scene.setAcceleration(Manta::Acceleration::Compiled);
+		double compiled = timeQueries(&scene, points, &compiledClosest);
+
+		unsigned int mismatches = 0;
+		for (unsigned int i = 0; i < NUM_QUERIES; i++) {
+			if (linearClosest[i] != bvhClosest[i]) mismatches++;
+			if (linearClosest[i] != compiledClosest[i]) mismatches++;
+		}
+
+		std::cout << std::setw(10) << count
+			<< std::setw(16) << std::fixed << std::setprecision(1) << linear
+			<< std::setw(16) << bvh
+			<< std::setw(16) << compiled
+			<< std::setw(12) << mismatches << std::endl;
+	}
+}
+
+// A cubic grid of spheres as one shape per sphere, as one instanced shape
+// and as one shape repeated by a finite Repeat. Build times run from the
+// first shape or instance placed to the snapshot from Scene::prepare().
+// Separate shapes stop at the sizes they still fit in memory.
+void benchInstancing() {
+	const int LIMITS[] = { 5, 10, 20, 50 };
+	const int SHAPE_LIMIT = 20;
+	const unsigned int NUM_QUERIES = 20000;
+	const float SPACING = 2;
+
+	std::cout << std::setw(10) << "spheres"
+		<< std::setw(14) << "shapes ms"
+		<< std::setw(14) << "shapes ns/q"
+		<< std::setw(14) << "instances ms"
+		<< std::setw(16) << "instances ns/q"
+		<< std::setw(14) << "repeat ns/q"
+		<< std::setw(14) << "max error" << std::endl;
+
+	for (int limit : LIMITS) {
+		int side = 2 * limit + 1;
+		unsigned int count = (unsigned int)(side * side * side);
+
+		std::mt19937 rng(1234);
+		float extent = SPACING * (limit + 1);
+		std::uniform_real_distribution<float> position(-extent, extent);
+
+		std::vector<sf::Vector3f> points(NUM_QUERIES);
+		for (auto& p : points) p = sf::Vector3f(position(rng), position(rng), position(rng));
+
+		std::vector<unsigned int> closest;
+		std::vector<float> instanceDistances, repeatDistances, shapeDistances;
+
+		auto sphereAt = [&](int x, int y, int z) {
+			return sf::Vector3f((float)x, (float)y, (float)z) * SPACING;
+		};
+
+		auto start = std::chrono::steady_clock::now();
+
+		Manta::Scene instanceScene;
+		auto instances = new Manta::Instances(Manta::Sphere());
+		for (int x = -limit; x <= limit; x++) {
+			for (int y = -limit; y <= limit; y++) {
+				for (int z = -limit; z <= limit; z++) instances->add(sphereAt(x, y, z), sf::Vector3f(.5f, .5f, .5f));
+			}
+		}
+		instanceScene.mountShape(Manta::Instanced(instances));
+		instanceScene.prepare();
+		double instanceBuild = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		double instanceQuery = timeQueries(&instanceScene, points, &closest, &instanceDistances);
+
+		Manta::Scene repeatScene;
+		auto repeated = Manta::Sphere();
+		repeated->pushTransform(new Manta::Repeat(sf::Vector3f(SPACING, SPACING, SPACING), sf::Vector3i(limit, limit, limit)));
+		auto scale = new Manta::Scale();
+		scale->factor = sf::Vector3f(.5f, .5f, .5f);
+		repeated->pushTransform(scale);
+		repeatScene.mountShape(repeated);
+		double repeatQuery = timeQueries(&repeatScene, points, &closest, &repeatDistances);
+
+		double shapeBuild = 0;
+		double shapeQuery = 0;
+		if (limit <= SHAPE_LIMIT) {
+			start = std::chrono::steady_clock::now();
+
+			Manta::Scene shapeScene;
+			shapeScene.setAcceleration(Manta::Acceleration::BVH);
+			for (int x = -limit; x <= limit; x++) {
+				for (int y = -limit; y <= limit; y++) {
+					for (int z = -limit; z <= limit; z++) {
+						auto sphere = Manta::Sphere();
+						Manta::placeShape(sphere, sphereAt(x, y, z), sf::Vector3f(.5f, .5f, .5f));
+						shapeScene.mountShape(sphere);
+					}
+				}
+			}
+
+			shapeScene.prepare();
+			shapeBuild = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+			shapeQuery = timeQueries(&shapeScene, points, &closest, &shapeDistances);
+		}
+
+		// Against the separate shapes where there are some, the instances
+		// otherwise
+		const std::vector<float>& reference = shapeDistances.empty() ? instanceDistances : shapeDistances;
+		float error = 0;
+		for (unsigned int i = 0; i < NUM_QUERIES; i++) {
+			error = fmaxf(error, fabsf(instanceDistances[i] - reference[i]));
+			error = fmaxf(error, fabsf(repeatDistances[i] - reference[i]));
+		}
+
+		std::cout << std::setw(10) << count << std::fixed << std::setprecision(1);
+		if (limit <= SHAPE_LIMIT) std::cout << std::setw(14) << shapeBuild << std::setw(14) << shapeQuery;
+		else std::cout << std::setw(14) << "-" << std::setw(14) << "-";
+		std::cout << std::setw(14) << instanceBuild
+			<< std::setw(16) << instanceQuery
+			<< std::setw(14) << repeatQuery
+			<< std::setw(14) << std::setprecision(6) << error << std::endl;
+	}
+}
+
+// Full frames of a scene whose geometry sits in one corner of the view,
+// once split into one column strip per worker and once into small tiles
+void benchScheduling() {
+	std::mt19937 rng(4321);
+	std::uniform_real_distribution<float> offset(-3, 3);
+
+	Manta::Scene scene;
+	scene.setSkyColor(Manta::Color(70, 90, 240));
+	scene.setAcceleration(Manta::Acceleration::BVH);
+
+	for (unsigned int i = 0; i < 400; i++) {
+		auto shape = Manta::Sphere();
+		shape->color = Manta::Color(rng() % 255, rng() % 255, rng() % 255);
+		shape->pushTransform(new Manta::Translate(sf::Vector3f(offset(rng), offset(rng) - 6, offset(rng) - 12)));
+		shape->pushTransform(new Manta::Scale());
+		((Manta::Scale*)shape->pipeline.back().get())->factor = sf::Vector3f(.4f, .4f, .4f);
+
+		scene.mountShape(shape);
+	}
+
+	Manta::CameraData cameraData;
+	cameraData.targetScene = &scene;
+	cameraData.dimensions = sf::Vector2u(640, 360);
+	cameraData.position = sf::Vector3f(-30, 0, 0);
+
+	BenchRenderHandler renderHandler(&cameraData);
+	Manta::PBRCamera camera(&cameraData, &renderHandler);
+
+	unsigned int nThreads = std::thread::hardware_concurrency();
+	if (nThreads == 0) nThreads = 1;
+
+	const sf::Vector2u TILE_SIZES[] = {
+		sf::Vector2u((cameraData.dimensions.x + nThreads - 1) / nThreads, cameraData.dimensions.y),
+		sf::Vector2u(64, 64),
+		sf::Vector2u(32, 32),
+		sf::Vector2u(16, 16)
+	};
+
+	std::cout << std::endl << std::setw(10) << "tile" << std::setw(16) << "frame ms" << std::endl;
+
+	for (sf::Vector2u tileSize : TILE_SIZES) {
+		cameraData.tileSize = tileSize;
+
+		// Warm up, also builds the BVH
+		camera.initWorkers();
+
+		const unsigned int FRAMES = 3;
+		auto start = std::chrono::steady_clock::now();
+		for (unsigned int i = 0; i < FRAMES; i++) camera.initWorkers();
+		auto end = std::chrono::steady_clock::now();
+
+		std::cout << std::setw(6) << tileSize.x << "x" << std::setw(3) << std::left << tileSize.y << std::right
+			<< std::setw(16) << std::setprecision(1)
+			<< std::chrono::duration<double, std::milli>(end - start).count() / FRAMES << std::endl;
+	}
+}
+
+struct SuiteOptions {
+	sf::Vector2u dimensions = sf::Vector2u(320, 180);
+	unsigned int threads = 0;
+	unsigned int frames = 3;
+	unsigned int seed = 1;
+	Manta::Acceleration acceleration = Manta::Acceleration::BVH;
+	Manta::Marching marching = Manta::Marching::Standard;
+	float relaxation = 1.2f;
+};
+
+struct SceneResult {
+	std::string name;
+	size_t shapes;
+
+	// Wall clock, averaged over the timed frames
+	double frameSeconds;
+	double compositeSeconds;
+
+	// Counted during one extra frame, so the timers don't slow the others
+	Manta::RenderStats stats;
+};
+
+// Renders the reference scenes with fixed seeds. Frame times come from
+// frames with RenderStats disabled, the counters and the albedo / shadow
+// split from one more frame with it enabled. Albedo and shadow time is
+// summed over all workers, so it can exceed the frame time.
+std::vector<SceneResult> runSuite(const SuiteOptions& options) {
+	const char* SCENES[] = { "sparse", "dense", "many", "shadow" };
+
+	std::vector<SceneResult> results;
+
+	for (const char* name : SCENES) {
+		Manta::Scene scene;
+		Manta::builtinScene(name, &scene, options.seed);
+		scene.setAcceleration(options.acceleration);
+
+		Manta::CameraData cameraData;
+		cameraData.targetScene = &scene;
+		cameraData.dimensions = options.dimensions;
+		cameraData.position = sf::Vector3f(-50, 0, 0);
+		cameraData.marching = options.marching;
+		cameraData.relaxation = options.relaxation;
+
+		BenchRenderHandler renderHandler(&cameraData);
+		Manta::PBRCamera camera(&cameraData, &renderHandler, options.threads);
+
+		SceneResult result;
+		result.name = name;
+		result.shapes = scene.getShapes()->size();
+
+		// Warm up, also builds the acceleration structure
+		camera.initWorkers();
+
+		auto start = std::chrono::steady_clock::now();
+		for (unsigned int i = 0; i < options.frames; i++) camera.initWorkers();
+		auto end = std::chrono::steady_clock::now();
+		result.frameSeconds = std::chrono::duration<double>(end - start).count() / options.frames;
+
+		// Every block marked, so each run composites the whole frame
+		Manta::ThreadPool compositors(options.threads);
+
+		start = std::chrono::steady_clock::now();
+		for (unsigned int i = 0; i < options.frames; i++) {
+			renderHandler.markAllDirty();
+			renderHandler.composite(&compositors);
+		}
+		end = std::chrono::steady_clock::now();
+		result.compositeSeconds = std::chrono::duration<double>(end - start).count() / options.frames;
+
+		Manta::RenderStats::reset();
+		Manta::RenderStats::setEnabled(true);
+		camera.initWorkers();
+		Manta::RenderStats::setEnabled(false);
+		result.stats = Manta::RenderStats::totals();
+
+		results.push_back(result);
+	}
+
+	return results;
+}
+
+void writeJSON(std::ostream& out, const SuiteOptions& options, const std::vector<SceneResult>& results) {
+	double pixels = (double)options.dimensions.x * options.dimensions.y;
+
+	out << std::fixed << std::setprecision(3);
+	out << "{\n";
+	out << "  \"width\": " << options.dimensions.x << ",\n";
+	out << "  \"height\": " << options.dimensions.y << ",\n";
+	unsigned int threads = options.threads;
+	if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+
+	out << "  \"threads\": " << threads << ",\n";
+	out << "  \"frames\": " << options.frames << ",\n";
+	out << "  \"seed\": " << options.seed << ",\n";
+	out << "  \"relaxation\": " << (options.marching == Manta::Marching::Relaxed ? options.relaxation : 1.f) << ",\n";
+	out << "  \"simdWidth\": " << Manta::simd::WIDTH << ",\n";
+	out << "  \"scenes\": [\n";
+
+	for (size_t i = 0; i < results.size(); i++) {
+		const SceneResult& result = results[i];
+		const Manta::RenderStats& stats = result.stats;
+
+		double primaryRays = (double)std::max<uint64_t>(stats.primaryRays, 1);
+		double shadowRays = (double)std::max<uint64_t>(stats.shadowRays, 1);
+
+		out << "    {\n";
+		out << "      \"name\": \"" << result.name << "\",\n";
+		out << "      \"shapes\": " << result.shapes << ",\n";
+		out << "      \"primaryRaysPerSecond\": " << pixels / result.frameSeconds << ",\n";
+		out << "      \"stepsPerRay\": { \"average\": " << stats.primarySteps / primaryRays
+			<< ", \"p99\": " << stats.stepPercentile(.99) << " },\n";
+		out << "      \"shadowRays\": " << stats.shadowRays << ",\n";
+		out << "      \"shadowStepsPerRay\": " << stats.shadowSteps / shadowRays << ",\n";
+		out << "      \"distanceEstimatesPerPixel\": " << stats.distanceEstimates / pixels << ",\n";
+		out << "      \"timingsMs\": { \"frame\": " << result.frameSeconds * 1000
+			<< ", \"albedo\": " << stats.albedoSeconds * 1000
+			<< ", \"shadow\": " << stats.shadowSeconds * 1000
+			<< ", \"composite\": " << result.compositeSeconds * 1000 << " }\n";
+		out << "    }" << (i + 1 < results.size() ? "," : "") << "\n";
+	}
+
+	out << "  ]\n";
+	out << "}\n";
+}
+
+// Variant of the camera settings compared by compareVariants()
+struct Variant {
+	std::string label;
+	std::function<void(Manta::CameraData*)> apply;
+};
+
+// Renders scenes, the reference scenes by default, once per variant and
+// prints one row per scene and variant. Differing pixels are counted on
+// the composite against the first variant, with an AO pass it darkens the
+// composite.
+void compareVariants(
+	const SuiteOptions& options,
+	const char* column,
+	const std::vector<Variant>& variants,
+	const Manta::PassRegistry& passes = Manta::PassRegistry::defaults(),
+	const std::vector<const char*>& scenes = { "sparse", "dense", "many", "shadow" }
+) {
+	double pixels = (double)options.dimensions.x * options.dimensions.y;
+
+	std::cout << std::setw(10) << "scene"
+		<< std::setw(10) << column
+		<< std::setw(16) << "index/pixel"
+		<< std::setw(18) << "estimates/pixel"
+		<< std::setw(14) << "steps/ray"
+		<< std::setw(10) << "p99"
+		<< std::setw(14) << "shadow/ray"
+		<< std::setw(10) << "sky %"
+		<< std::setw(12) << "frame ms"
+		<< std::setw(12) << "differing" << std::endl;
+
+	for (const char* name : scenes) {
+		Manta::Scene scene;
+		Manta::builtinScene(name, &scene, options.seed);
+		scene.setAcceleration(options.acceleration);
+
+		Manta::CameraData cameraData;
+		cameraData.targetScene = &scene;
+		cameraData.dimensions = options.dimensions;
+		cameraData.position = sf::Vector3f(-50, 0, 0);
+
+		BenchRenderHandler renderHandler(&cameraData, passes);
+		Manta::PBRCamera camera(&cameraData, &renderHandler, options.threads);
+		if (passes.has(Manta::Pass::AO)) renderHandler.setCompositeBlend(0, Manta::Color(), 1);
+
+		size_t bytes = (size_t)pixels * 4;
+		std::vector<sf::Uint8> reference;
+
+		for (const Variant& variant : variants) {
+			Manta::CameraData defaults;
+			cameraData.marching = defaults.marching;
+			cameraData.relaxation = defaults.relaxation;
+			cameraData.coneCellSize = defaults.coneCellSize;
+			cameraData.clipToBounds = defaults.clipToBounds;
+			cameraData.aoSamples = defaults.aoSamples;
+			cameraData.aoHalfResolution = defaults.aoHalfResolution;
+			cameraData.detailPixels = defaults.detailPixels;
+			scene.setDistanceCache(Manta::DistanceCacheSettings());
+			variant.apply(&cameraData);
+
+			// Warm up, also builds the acceleration structure
+			camera.initWorkers();
+
+			auto start = std::chrono::steady_clock::now();
+			for (unsigned int i = 0; i < options.frames; i++) camera.initWorkers();
+			auto end = std::chrono::steady_clock::now();
+			double frameSeconds = std::chrono::duration<double>(end - start).count() / options.frames;
+
+			Manta::RenderStats::reset();
+			Manta::RenderStats::setEnabled(true);
+			camera.initWorkers();
+			Manta::RenderStats::setEnabled(false);
+			Manta::RenderStats stats = Manta::RenderStats::totals();
+
+			renderHandler.composite();
+			const sf::Uint8* bitmap = renderHandler.getBitmap();
+			if (reference.empty()) reference.assign(bitmap, bitmap + bytes);
+
+			unsigned int differing = 0;
+			for (size_t i = 0; i < bytes; i += 4) {
+				if (memcmp(&reference[i], &bitmap[i], 4) != 0) differing++;
+			}
+
+			double primaryRays = (double)std::max<uint64_t>(stats.primaryRays, 1);
+
+			std::cout << std::setw(10) << name
+				<< std::setw(10) << variant.label
+				<< std::setw(16) << std::fixed << std::setprecision(2) << stats.sceneIndexCalls / pixels
+				<< std::setw(18) << stats.distanceEstimates / pixels
+				<< std::setw(14) << stats.primarySteps / primaryRays
+				<< std::setw(10) << stats.stepPercentile(.99)
+				<< std::setw(14) << stats.shadowSteps / (double)std::max<uint64_t>(stats.shadowRays, 1)
+				<< std::setw(10) << std::setprecision(1) << (primaryRays - stats.shadowRays) * 100 / primaryRays
+				<< std::setw(12) << frameSeconds * 1000
+				<< std::setw(12) << differing << std::endl;
+		}
+	}
+}
+
+// Standard sphere tracing against over-relaxed marching at growing factors
+void benchMarching(const SuiteOptions& options) {
+	std::vector<Variant> variants;
+
+	for (float relaxation : { 1.f, 1.2f, 1.4f, 1.6f, 1.8f }) {
+		std::ostringstream label;
+		label << std::fixed << std::setprecision(1) << relaxation;
+
+		variants.push_back(Variant{ label.str(), [relaxation](Manta::CameraData* cameraData) {
+			cameraData->marching = relaxation > 1 ? Manta::Marching::Relaxed : Manta::Marching::Standard;
+			cameraData->relaxation = relaxation;
+		} });
+	}
+
+	compareVariants(options, "omega", variants);
+}
+
+// Rays marched up to maxDistance against rays clipped to the scene bound.
+// Sky pixels and lit shadow rays are the ones that get cheaper.
+void benchBounds(const SuiteOptions& options) {
+	compareVariants(options, "bounds", {
+		Variant{ "off", [](Manta::CameraData* cameraData) { cameraData->clipToBounds = false; } },
+		Variant{ "on", [](Manta::CameraData* cameraData) { cameraData->clipToBounds = true; } }
+	});
+}
+
+// Exact evaluation against the baked distance cache at a few resolutions.
+// The cache is built during the untimed warm up frame.
+void benchCache(const SuiteOptions& options) {
+	std::vector<Variant> variants;
+	variants.push_back(Variant{ "off", [](Manta::CameraData*) {} });
+
+	for (unsigned int resolution : { 64u, 128u, 256u }) {
+		variants.push_back(Variant{ std::to_string(resolution), [resolution](Manta::CameraData* cameraData) {
+			Manta::DistanceCacheSettings settings;
+			settings.enabled = true;
+			settings.resolution = resolution;
+			cameraData->targetScene->setDistanceCache(settings);
+		} });
+	}
+
+	compareVariants(options, "cache", variants);
+}
+
+// Frame time without ambient occlusion against a few sample counts at full
+// and half resolution. Differing pixels are counted against the
+// unoccluded composite, so they show how much AO changes the image.
+void benchAO(const SuiteOptions& options) {
+	std::vector<Variant> variants;
+	variants.push_back(Variant{ "off", [](Manta::CameraData*) {} });
+
+	for (bool half : { false, true }) {
+		for (unsigned int samples : { 3u, 5u }) {
+			std::string label = std::to_string(samples) + (half ? " half" : " full");
+			variants.push_back(Variant{ label, [samples, half](Manta::CameraData* cameraData) {
+				cameraData->aoSamples = samples;
+				cameraData->aoHalfResolution = half;
+			} });
+		}
+	}
+
+	compareVariants(options, "ao", variants, Manta::PassRegistry::defaults().request(Manta::Pass::AO, Manta::PassFormat::U8));
+}
+
+// CSG trees evaluated leaf by leaf against trees that skip subtrees whose
+// bound is farther than the best distance so far. Differing pixels come
+// from pruned subtrees answering with their bound distance, which can be
+// larger than the estimate of a non-uniformly scaled leaf.
+void benchCSG(const SuiteOptions& options) {
+	compareVariants(options, "pruning", {
+		Variant{ "off", [](Manta::CameraData*) { Manta::CSG::setPruning(false); } },
+		Variant{ "on", [](Manta::CameraData*) { Manta::CSG::setPruning(true); } }
+	}, Manta::PassRegistry::defaults(), { "csg" });
+}
+
+// Fractals iterated fully everywhere against iteration counts and escape
+// radii that follow the pixel footprint at a few detail sizes. Differing
+// pixels are counted against full detail.
+void benchDetail(const SuiteOptions& options) {
+	std::vector<Variant> variants;
+	variants.push_back(Variant{ "fixed", [](Manta::CameraData* cameraData) { cameraData->detailPixels = 0; } });
+
+	for (float pixels : { .5f, 1.f, 2.f }) {
+		std::ostringstream label;
+		label << std::fixed << std::setprecision(1) << pixels << " px";
+
+		variants.push_back(Variant{ label.str(), [pixels](Manta::CameraData* cameraData) { cameraData->detailPixels = pixels; } });
+	}
+
+	compareVariants(options, "detail", variants, Manta::PassRegistry::defaults(), { "fractal" });
+}
+
+// Fly-through of FRAMES frames with the camera drifting forward and
+// turning a little, every frame marched in full against frames warped from
+// the previous one. Counters are summed over the whole flight, differing
+// pixels are counted on every frame's composite against the full render.
+void benchReprojection(const SuiteOptions& options) {
+	const char* SCENES[] = { "sparse", "dense", "many", "shadow" };
+	const unsigned int FRAMES = 32;
+
+	double pixels = (double)options.dimensions.x * options.dimensions.y;
+	size_t bytes = (size_t)pixels * 4;
+
+	std::cout << std::setw(10) << "scene"
+		<< std::setw(10) << "reproject"
+		<< std::setw(14) << "rays/pixel"
+		<< std::setw(14) << "steps/pixel"
+		<< std::setw(16) << "index/pixel"
+		<< std::setw(12) << "frame ms"
+		<< std::setw(14) << "differing %" << std::endl;
+
+	for (const char* name : SCENES) {
+		Manta::Scene scene;
+		Manta::builtinScene(name, &scene, options.seed);
+		scene.setAcceleration(options.acceleration);
+
+		Manta::CameraData full;
+		full.targetScene = &scene;
+		full.dimensions = options.dimensions;
+		full.position = sf::Vector3f(-50, 0, 0);
+
+		Manta::CameraData warped = full;
+		warped.reprojection = true;
+
+		// Reprojection warps the hit positions
+		Manta::PassRegistry passes = Manta::PassRegistry::defaults().request(Manta::Pass::Position, Manta::PassFormat::Float);
+
+		BenchRenderHandler fullHandler(&full, passes);
+		BenchRenderHandler warpedHandler(&warped, passes);
+		Manta::PBRCamera fullCamera(&full, &fullHandler, options.threads);
+		Manta::PBRCamera warpedCamera(&warped, &warpedHandler, options.threads);
+
+		Manta::RenderStats totals[2];
+		double seconds[2] = { 0, 0 };
+		double differing = 0;
+
+		Manta::RenderStats::setEnabled(true);
+
+		for (unsigned int frame = 0; frame < FRAMES; frame++) {
+			full.position += sf::Vector3f(.2f, 0, .05f);
+			full.rotation.y += .003f;
+			warped.position = full.position;
+			warped.rotation = full.rotation;
+
+			Manta::PBRCamera* cameras[2] = { &fullCamera, &warpedCamera };
+			for (unsigned int i = 0; i < 2; i++) {
+				Manta::RenderStats::reset();
+
+				auto start = std::chrono::steady_clock::now();
+				cameras[i]->initWorkers();
+				seconds[i] += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+				Manta::RenderStats stats = Manta::RenderStats::totals();
+				totals[i].primaryRays += stats.primaryRays;
+				totals[i].primarySteps += stats.primarySteps;
+				totals[i].sceneIndexCalls += stats.sceneIndexCalls;
+			}
+
+			fullHandler.composite();
+			warpedHandler.composite();
+
+			const sf::Uint8* reference = fullHandler.getBitmap();
+			const sf::Uint8* bitmap = warpedHandler.getBitmap();
+			for (size_t i = 0; i < bytes; i += 4) {
+				if (memcmp(&reference[i], &bitmap[i], 4) != 0) differing++;
+			}
+		}
+
+		Manta::RenderStats::setEnabled(false);
+
+		for (unsigned int i = 0; i < 2; i++) {
+			double samples = pixels * FRAMES;
+
+			std::cout << std::setw(10) << name
+				<< std::setw(10) << (i == 0 ? "off" : "on")
+				<< std::setw(14) << std::fixed << std::setprecision(3) << totals[i].primaryRays / samples
+				<< std::setw(14) << std::setprecision(2) << totals[i].primarySteps / samples
+				<< std::setw(16) << totals[i].sceneIndexCalls / samples
+				<< std::setw(12) << seconds[i] * 1000 / FRAMES
+				<< std::setw(14) << (i == 0 ? 0 : differing * 100 / samples) << std::endl;
+		}
+	}
+}
+
+void printUsage() {
+	std::cout <<
+		"Usage: MantaBench [suite|scene-index|scheduling|marching|bounds|cache|reprojection|ao|csg|instancing|detail] [options]\n"
+		"  suite                      reference scenes as JSON (default)\n"
+		"  scene-index                linear scan against BVH and compiled scene\n"
+		"  scheduling                 strips against tiles of different sizes\n"
+		"  marching                   standard against over-relaxed sphere tracing\n"
+		"  bounds                     rays clipped to the scene bound or not\n"
+		"  cache                      exact scene evaluation against the distance cache\n"
+		"  reprojection               fly-through marched in full or warped from the previous frame\n"
+		"  ao                         ambient occlusion sample counts at full and half resolution\n"
+		"  csg                        CSG trees with and without bound pruning\n"
+		"  instancing                 separate shapes against instances and domain repetition\n"
+		"  detail                     fractals at full detail against detail following the pixel footprint\n"
+		"Suite options:\n"
+		"  --size WxH                 resolution (320x180)\n"
+		"  --threads N                render workers, 0 uses every hardware thread (0)\n"
+		"  --frames N                 timed frames per scene (3)\n"
+		"  --seed N                   seed of the reference scenes (1)\n"
+		"  --acceleration none|bvh|compiled  scene acceleration (bvh)\n"
+		"  --relaxation W             over-relaxed marching with factor W, 1 is standard (1)\n"
+		"  --output FILE              write the JSON there instead of stdout\n";
+}
+
+int main(int argc, char** argv) {
+	std::string mode = "suite";
+	std::string output;
+	SuiteOptions options;
+
+	int first = 1;
+	if (argc > 1 && argv[1][0] != '-') {
+		mode = argv[1];
+		first = 2;
+	}
+
+	for (int i = first; i < argc; i++) {
+		std::string option = argv[i];
+
+		if (option == "--help" || option == "-h" || i + 1 >= argc) {
+			printUsage();
+			return option == "--help" || option == "-h" ? 0 : 1;
+		}
+		std::string value = argv[++i];
+
+		bool valid = true;
+		if (option == "--size") valid = sscanf(value.c_str(), "%ux%u", &options.dimensions.x, &options.dimensions.y) == 2;
+		else if (option == "--threads") options.threads = (unsigned int)std::stoul(value);
+		else if (option == "--frames") valid = (options.frames = (unsigned int)std::stoul(value)) > 0;
+		else if (option == "--seed") options.seed = (unsigned int)std::stoul(value);
+		else if (option == "--output") output = value;
+		else if (option == "--relaxation") {
+			options.relaxation = std::stof(value);
+			options.marching = options.relaxation > 1 ? Manta::Marching::Relaxed : Manta::Marching::Standard;
+			valid = options.relaxation >= 1 && options.relaxation < 2;
+		}
+		else if (option == "--acceleration") {
+			if (value == "none") options.acceleration = Manta::Acceleration::None;
+			else if (value == "bvh") options.acceleration = Manta::Acceleration::BVH;
+			else if (value == "compiled") options.acceleration = Manta::Acceleration::Compiled;
+			else valid = false;
+		}
+		else valid = false;
+
+		if (!valid) {
+			std::cerr << "Invalid option " << option << " " << value << std::endl;
+			return 1;
+		}
+	}
+
+	if (mode == "scene-index") {
+		benchSceneIndex();
+	}
+	else if (mode == "scheduling") {
+		benchScheduling();
+	}
+	else if (mode == "marching") {
+		benchMarching(options);
+	}
+	else if (mode == "bounds") {
+		benchBounds(options);
+	}
+	else if (mode == "cache") {
+		benchCache(options);
+	}
+	else if (mode == "reprojection") {
+		benchReprojection(options);
+	}
+	else if (mode == "ao") {
+		benchAO(options);
+	}
+	else if (mode == "csg") {
+		benchCSG(options);
+	}
+	else if (mode == "instancing") {
+		benchInstancing();
+	}
+	else if (mode == "detail") {
+		benchDetail(options);
+	}
+	else if (mode == "suite") {
+		std::vector<SceneResult> results = runSuite(options);
+
+		if (output.empty()) {
+			writeJSON(std::cout, options, results);
+		}
+		else {
+			std::ofstream file(output);
+			writeJSON(file, options, results);
+			if (!file) {
+				std::cerr << "Could not write " << output << std::endl;
+				return 1;
+			}
+		}
+	}
+	else {
+		printUsage();
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,229 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include <SFML/System.hpp>
+
+#include "../Manta/Scene.hpp"
+#include "../Manta/Scenes.hpp"
+#include "../Manta/Camera.hpp"
+#include "../Manta/HeadlessRenderHandler.hpp"
+#include "../Manta/RenderStats.hpp"
+
+// Renders one frame without a window and writes the composite and every
+// pass next to each other, see printUsage() for the options
+
+void printUsage() {
+	std::cout <<
+		"Usage: MantaCLI [options]\n"
+		"  --size WxH                 resolution (1280x720)\n"
+		"  --threads N                render workers, 0 uses every hardware thread (0)\n"
+		"  --scene NAME|FILE          demo, sparse, dense, many, shadow, csg,\n"
+		"                             instanced, fractal or a scene file (demo)\n"
+		"  --output PREFIX            written as PREFIX.ppm, PREFIX_albedo.ppm, ... (render)\n"
+		"  --position X,Y,Z           camera position (-50,0,0)\n"
+		"  --rotation X,Y,Z           camera rotation in degrees (0,0,0)\n"
+		"  --packet N                 primary rays marched together: 1, 4, 8 or 16 (1)\n"
+		"  --acceleration none|bvh|compiled  scene acceleration (bvh)\n"
+		"  --relaxation W             over-relaxed sphere tracing with factor W, 1 is standard (1)\n"
+		"  --distance-cache N         bake a distance cache with N samples along the scene (off)\n"
+		"  --cache-budget MB          memory of the cache sample grids (64)\n"
+		"  --passes LIST              passes to keep and write, NAME[:u8|half|float] separated by commas,\n"
+		"                             from albedo, light, mist, ao, depth, position, normal and cost\n"
+		"                             (albedo:u8,light:half,mist:u8,depth:float)\n"
+		"  --ao N                     ambient occlusion from N samples per hit, adds the ao pass (off)\n"
+		"  --ao-distance D            farthest ambient occlusion sample from the hit (1)\n"
+		"  --ao-half                  ambient occlusion at half resolution, upsampled by depth\n"
+		"  --detail PIXELS            fractal detail below PIXELS pixels is skipped, 0 is full detail (1)\n"
+		"  --stats                    fill the cost pass and print the render counters\n";
+}
+
+bool parseVector(const std::string& text, sf::Vector3f* out) {
+	return sscanf(text.c_str(), "%f,%f,%f", &out->x, &out->y, &out->z) == 3;
+}
+
+// Comma separated NAME[:FORMAT] list, passes without a format get the one
+// they have by default or float
+bool parsePasses(const std::string& text, Manta::PassRegistry* out) {
+	Manta::PassRegistry defaults = Manta::PassRegistry::defaults();
+	*out = Manta::PassRegistry();
+
+	size_t start = 0;
+	while (start <= text.size()) {
+		size_t end = text.find(',', start);
+		if (end == std::string::npos) end = text.size();
+
+		std::string item = text.substr(start, end - start);
+		std::string format;
+		size_t colon = item.find(':');
+		if (colon != std::string::npos) {
+			format = item.substr(colon + 1);
+			item = item.substr(0, colon);
+		}
+
+		unsigned int i = 0;
+		while (i < (unsigned int)Manta::Pass::Count && item != Manta::PassRegistry::name((Manta::Pass)i)) i++;
+		if (i == (unsigned int)Manta::Pass::Count) return false;
+
+		Manta::Pass pass = (Manta::Pass)i;
+		Manta::PassFormat passFormat = defaults.has(pass) ? defaults.format(pass) : Manta::PassFormat::Float;
+		if (format == "u8") passFormat = Manta::PassFormat::U8;
+		else if (format == "half") passFormat = Manta::PassFormat::Half;
+		else if (format == "float") passFormat = Manta::PassFormat::Float;
+		else if (!format.empty()) return false;
+
+		out->request(pass, passFormat);
+		start = end + 1;
+	}
+	return true;
+}
+
+int main(int argc, char** argv) {
+	sf::Vector2u dimensions(1280, 720);
+	unsigned int threads = 0;
+	std::string sceneName = "demo";
+	std::string output = "render";
+
+	auto cameraData = Manta::CameraData();
+	cameraData.position = sf::Vector3f(-50, 0, 0);
+
+	Manta::Acceleration acceleration = Manta::Acceleration::BVH;
+	Manta::DistanceCacheSettings cacheSettings;
+	bool stats = false;
+	Manta::PassRegistry passes = Manta::PassRegistry::defaults();
+
+	for (int i = 1; i < argc; i++) {
+		std::string option = argv[i];
+
+		if (option == "--help" || option == "-h") {
+			printUsage();
+			return 0;
+		}
+		if (option == "--stats") {
+			stats = true;
+			continue;
+		}
+		if (option == "--ao-half") {
+			cameraData.aoHalfResolution = true;
+			continue;
+		}
+		if (i + 1 >= argc) {
+			std::cerr << "Missing value for " << option << std::endl;
+			return 1;
+		}
+		std::string value = argv[++i];
+
+		bool valid = true;
+		if (option == "--size") {
+			valid = sscanf(value.c_str(), "%ux%u", &dimensions.x, &dimensions.y) == 2 && dimensions.x > 0 && dimensions.y > 0;
+		}
+		else if (option == "--threads") {
+			threads = (unsigned int)std::strtoul(value.c_str(), nullptr, 10);
+		}
+		else if (option == "--scene") {
+			sceneName = value;
+		}
+		else if (option == "--output") {
+			output = value;
+		}
+		else if (option == "--position") {
+			valid = parseVector(value, &cameraData.position);
+		}
+		else if (option == "--rotation") {
+			sf::Vector3f degrees;
+			valid = parseVector(value, &degrees);
+			cameraData.rotation = sf::Vector3f(Manta::degToRad(degrees.x), Manta::degToRad(degrees.y), Manta::degToRad(degrees.z));
+		}
+		else if (option == "--packet") {
+			cameraData.packetSize = (unsigned int)std::strtoul(value.c_str(), nullptr, 10);
+			valid = cameraData.packetSize == 1 || cameraData.packetSize == 4 || cameraData.packetSize == 8 || cameraData.packetSize == 16;
+		}
+		else if (option == "--relaxation") {
+			cameraData.relaxation = std::strtof(value.c_str(), nullptr);
+			cameraData.marching = cameraData.relaxation > 1 ? Manta::Marching::Relaxed : Manta::Marching::Standard;
+			valid = cameraData.relaxation >= 1 && cameraData.relaxation < 2;
+		}
+		else if (option == "--distance-cache") {
+			cacheSettings.resolution = (unsigned int)std::strtoul(value.c_str(), nullptr, 10);
+			cacheSettings.enabled = true;
+			valid = cacheSettings.resolution > 0;
+		}
+		else if (option == "--cache-budget") {
+			cacheSettings.memoryBudget = (size_t)std::strtoul(value.c_str(), nullptr, 10) << 20;
+		}
+		else if (option == "--ao") {
+			cameraData.aoSamples = (unsigned int)std::strtoul(value.c_str(), nullptr, 10);
+		}
+		else if (option == "--ao-distance") {
+			cameraData.aoDistance = std::strtof(value.c_str(), nullptr);
+			valid = cameraData.aoDistance > 0;
+		}
+		else if (option == "--detail") {
+			cameraData.detailPixels = std::strtof(value.c_str(), nullptr);
+			valid = cameraData.detailPixels >= 0;
+		}
+		else if (option == "--passes") {
+			valid = parsePasses(value, &passes);
+		}
+		else if (option == "--acceleration") {
+			if (value == "none") acceleration = Manta::Acceleration::None;
+			else if (value == "bvh") acceleration = Manta::Acceleration::BVH;
+			else if (value == "compiled") acceleration = Manta::Acceleration::Compiled;
+			else valid = false;
+		}
+		else {
+			std::cerr << "Unknown option " << option << std::endl;
+			printUsage();
+			return 1;
+		}
+
+		if (!valid) {
+			std::cerr << "Invalid value for " << option << ": " << value << std::endl;
+			return 1;
+		}
+	}
+
+	Manta::Scene scene;
+	scene.setAcceleration(acceleration);
+	scene.setDistanceCache(cacheSettings);
+
+	if (!Manta::builtinScene(sceneName, &scene)) {
+		std::string error;
+		if (!Manta::loadScene(sceneName, &scene, &error)) {
+			std::cerr << error << std::endl;
+			return 1;
+		}
+	}
+
+	cameraData.targetScene = &scene;
+	cameraData.dimensions = dimensions;
+
+	if (stats && !passes.has(Manta::Pass::Cost)) passes.request(Manta::Pass::Cost, Manta::PassFormat::Float);
+	if (cameraData.aoSamples > 0 && !passes.has(Manta::Pass::AO)) passes.request(Manta::Pass::AO, Manta::PassFormat::U8);
+
+	Manta::HeadlessRenderHandler renderHandler(&cameraData, passes);
+	if (cameraData.aoSamples > 0) renderHandler.setCompositeBlend(0, Manta::Color(), 1);
+	Manta::PBRCamera camera(&cameraData, &renderHandler, threads);
+
+	Manta::RenderStats::setEnabled(stats);
+
+	auto start = std::chrono::steady_clock::now();
+	camera.initWorkers();
+	auto end = std::chrono::steady_clock::now();
+
+	std::cout << "Rendered " << dimensions.x << "x" << dimensions.y
+		<< " with " << scene.getShapes()->size() << " shapes in "
+		<< std::chrono::duration<double, std::milli>(end - start).count() << " ms, passes take "
+		<< renderHandler.memoryUsage() / 1024 << " KiB" << std::endl;
+
+	if (stats) Manta::RenderStats::totals().dump(std::cout);
+
+	if (!renderHandler.writePasses(output)) {
+		std::cerr << "Could not write " << output << ".ppm and its passes" << std::endl;
+		return 1;
+	}
+
+	return 0;
+}